@@ -0,0 +1,339 @@
+/**
+ * @file    aesd-circular-buffer-bench.c
+ * @brief   Microbenchmark of aesd-circular-buffer.c. Sweeps the buffer capacity, the
+ *          distribution of entry sizes and the access pattern, and prints one CSV row per
+ *          case with the best ns/op out of several repetitions, plus cache misses and
+ *          instructions per op when hardware perf counters are available ("" otherwise).
+ *          Rows come out in a fixed order, so the outputs of two commits can be diffed.
+ *
+ *          Access patterns:
+ *            add        aesd_circular_buffer_add_entry() on a full buffer, evicting each time
+ *            seq_fpos   find_entry_offset_for_fpos() walking the buffer in 64 byte reads
+ *            rand_fpos  find_entry_offset_for_fpos() at uniformly random fpos
+ *            seek_end   find_entry_offset_for_fpos() of the last byte, as after SEEK_END
+ *
+ *          Usage: aesd-circular-buffer-bench [ops per case] [repetitions]
+ *
+ * @author  Suhas-Reddy-S
+ **/
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#include "aesd-circular-buffer.h"
+
+#define BENCH_DEFAULT_OPS 1000000
+#define BENCH_DEFAULT_REPS 5
+#define BENCH_SEQ_READ_SIZE 64
+// Random fpos are precomputed so the generator stays out of the measurement
+#define BENCH_RAND_FPOS_COUNT 4096
+#define BENCH_MAX_ENTRY_SIZE 4096
+
+enum bench_counter {
+    BENCH_CACHE_MISSES,
+    BENCH_INSTRUCTIONS,
+    BENCH_NR_COUNTERS
+};
+
+enum bench_pattern {
+    BENCH_ADD,
+    BENCH_SEQ_FPOS,
+    BENCH_RAND_FPOS,
+    BENCH_SEEK_END,
+    BENCH_NR_PATTERNS
+};
+
+static const char *const pattern_names[BENCH_NR_PATTERNS] = {
+    [BENCH_ADD] = "add",
+    [BENCH_SEQ_FPOS] = "seq_fpos",
+    [BENCH_RAND_FPOS] = "rand_fpos",
+    [BENCH_SEEK_END] = "seek_end",
+};
+
+struct bench_result {
+    double ns_per_op;
+    // Negative when the counter could not be read
+    double per_op[BENCH_NR_COUNTERS];
+};
+
+struct bench_sizes {
+    const char *name;
+    size_t (*next)(uint64_t *state);
+};
+
+static const unsigned int capacities[] = { 10, 64, 1024, AESDCHAR_MAX_CAPACITY };
+
+static int counter_fds[BENCH_NR_COUNTERS] = { -1, -1 };
+static char payload[BENCH_MAX_ENTRY_SIZE];
+// Keeps the compiler from dropping lookups whose result is otherwise unused
+static volatile size_t sink;
+
+static uint64_t xorshift64(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static size_t sizes_fixed(uint64_t *state)
+{
+    (void)state;
+    return 16;
+}
+
+static size_t sizes_uniform(uint64_t *state)
+{
+    return 1 + xorshift64(state) % 256;
+}
+
+// Mostly short commands with an occasional large one
+static size_t sizes_bimodal(uint64_t *state)
+{
+    return xorshift64(state) % 10 == 0 ? BENCH_MAX_ENTRY_SIZE : 16;
+}
+
+static const struct bench_sizes size_distributions[] = {
+    { "fixed16", sizes_fixed },
+    { "uniform1_256", sizes_uniform },
+    { "bimodal16_4096", sizes_bimodal },
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void counters_open(void)
+{
+#ifdef __linux__
+    static const uint64_t configs[BENCH_NR_COUNTERS] = {
+        [BENCH_CACHE_MISSES] = PERF_COUNT_HW_CACHE_MISSES,
+        [BENCH_INSTRUCTIONS] = PERF_COUNT_HW_INSTRUCTIONS,
+    };
+
+    for (int i = 0; i < BENCH_NR_COUNTERS; i++) {
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[i];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        counter_fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+}
+
+static void counters_close(void)
+{
+    for (int i = 0; i < BENCH_NR_COUNTERS; i++) {
+        if (counter_fds[i] >= 0) {
+            close(counter_fds[i]);
+        }
+    }
+}
+
+static void counters_start(void)
+{
+#ifdef __linux__
+    for (int i = 0; i < BENCH_NR_COUNTERS; i++) {
+        if (counter_fds[i] >= 0) {
+            ioctl(counter_fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counter_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+static void counters_stop(struct bench_result *result, unsigned long ops)
+{
+    for (int i = 0; i < BENCH_NR_COUNTERS; i++) {
+        uint64_t value;
+
+        result->per_op[i] = -1;
+        if (counter_fds[i] < 0) {
+            continue;
+        }
+#ifdef __linux__
+        ioctl(counter_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+#endif
+        if (read(counter_fds[i], &value, sizeof(value)) == sizeof(value)) {
+            result->per_op[i] = (double)value / ops;
+        }
+    }
+}
+
+// Fills @param buffer to capacity with entries sized by @param sizes
+static void bench_fill(struct aesd_circular_buffer *buffer, const struct bench_sizes *sizes, uint64_t *state)
+{
+    struct aesd_buffer_entry entry = { .buffptr = payload };
+
+    while (!buffer->full) {
+        entry.size = sizes->next(state);
+        aesd_circular_buffer_add_entry(buffer, &entry);
+    }
+}
+
+static void bench_add(struct aesd_circular_buffer *buffer, const struct bench_sizes *sizes,
+        unsigned long ops, uint64_t *state)
+{
+    struct aesd_buffer_entry entry = { .buffptr = payload };
+
+    for (unsigned long i = 0; i < ops; i++) {
+        // The size generator runs in the loop, it is a few instructions next to the add
+        entry.size = sizes->next(state);
+        sink = (size_t)aesd_circular_buffer_add_entry(buffer, &entry);
+    }
+}
+
+static void bench_seq_fpos(struct aesd_circular_buffer *buffer, unsigned long ops)
+{
+    size_t total = aesd_circular_buffer_size(buffer);
+    size_t fpos = 0, entry_offset;
+
+    for (unsigned long i = 0; i < ops; i++) {
+        sink = (size_t)aesd_circular_buffer_find_entry_offset_for_fpos(buffer, fpos, &entry_offset);
+        fpos += BENCH_SEQ_READ_SIZE;
+        if (fpos >= total) {
+            fpos = 0;
+        }
+    }
+}
+
+static void bench_rand_fpos(struct aesd_circular_buffer *buffer, const size_t *fpos, unsigned long ops)
+{
+    size_t entry_offset;
+
+    for (unsigned long i = 0; i < ops; i++) {
+        sink = (size_t)aesd_circular_buffer_find_entry_offset_for_fpos(buffer,
+                fpos[i % BENCH_RAND_FPOS_COUNT], &entry_offset);
+    }
+}
+
+static void bench_seek_end(struct aesd_circular_buffer *buffer, unsigned long ops)
+{
+    size_t entry_offset;
+
+    for (unsigned long i = 0; i < ops; i++) {
+        sink = (size_t)aesd_circular_buffer_find_entry_offset_for_fpos(buffer,
+                aesd_circular_buffer_size(buffer) - 1, &entry_offset);
+    }
+}
+
+/**
+ * Runs access pattern @param pattern @param reps times on a freshly filled buffer and
+ * keeps the fastest run, the one least disturbed by the rest of the system.
+ * @return 0 on success or a negative errno value
+ */
+static int bench_case(unsigned int capacity, const struct bench_sizes *sizes, enum bench_pattern pattern,
+        unsigned long ops, unsigned int reps, struct bench_result *best)
+{
+    static size_t fpos[BENCH_RAND_FPOS_COUNT];
+
+    *best = (struct bench_result){ .ns_per_op = -1, .per_op = { -1, -1 } };
+    for (unsigned int rep = 0; rep < reps; rep++) {
+        struct aesd_circular_buffer buffer;
+        struct bench_result result;
+        uint64_t state = 0x9e3779b97f4a7c15ull;
+        uint64_t start;
+        int rc;
+
+        rc = aesd_circular_buffer_init_capacity(&buffer, capacity);
+        if (rc != 0) {
+            return rc;
+        }
+        bench_fill(&buffer, sizes, &state);
+        for (size_t i = 0; i < BENCH_RAND_FPOS_COUNT; i++) {
+            fpos[i] = xorshift64(&state) % aesd_circular_buffer_size(&buffer);
+        }
+
+        counters_start();
+        start = now_ns();
+        switch (pattern) {
+        case BENCH_ADD:
+            bench_add(&buffer, sizes, ops, &state);
+            break;
+        case BENCH_SEQ_FPOS:
+            bench_seq_fpos(&buffer, ops);
+            break;
+        case BENCH_RAND_FPOS:
+            bench_rand_fpos(&buffer, fpos, ops);
+            break;
+        default:
+            bench_seek_end(&buffer, ops);
+            break;
+        }
+        result.ns_per_op = (double)(now_ns() - start) / ops;
+        counters_stop(&result, ops);
+        aesd_circular_buffer_free(&buffer);
+
+        if (best->ns_per_op < 0 || result.ns_per_op < best->ns_per_op) {
+            *best = result;
+        }
+    }
+    return 0;
+}
+
+static void print_counter(double per_op)
+{
+    if (per_op >= 0) {
+        printf(",%.3f", per_op);
+    } else {
+        printf(",");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long ops = argc > 1 ? strtoul(argv[1], NULL, 0) : BENCH_DEFAULT_OPS;
+    unsigned int reps = argc > 2 ? (unsigned int)strtoul(argv[2], NULL, 0) : BENCH_DEFAULT_REPS;
+
+    if (ops == 0 || reps == 0) {
+        fprintf(stderr, "Usage: %s [ops per case] [repetitions]\n", argv[0]);
+        return 1;
+    }
+    memset(payload, 'x', sizeof(payload));
+    counters_open();
+    if (counter_fds[BENCH_CACHE_MISSES] < 0) {
+        fprintf(stderr, "perf counters unavailable, cache miss columns left empty\n");
+    }
+
+    printf("pattern,capacity,sizes,ops,ns_per_op,cache_misses_per_op,instructions_per_op\n");
+    for (size_t c = 0; c < sizeof(capacities) / sizeof(capacities[0]); c++) {
+        for (size_t s = 0; s < sizeof(size_distributions) / sizeof(size_distributions[0]); s++) {
+            for (enum bench_pattern p = 0; p < BENCH_NR_PATTERNS; p++) {
+                struct bench_result result;
+                int rc = bench_case(capacities[c], &size_distributions[s], p, ops, reps, &result);
+
+                if (rc != 0) {
+                    fprintf(stderr, "Buffer of capacity %u: %s\n", capacities[c], strerror(-rc));
+                    counters_close();
+                    return 1;
+                }
+                printf("%s,%u,%s,%lu,%.2f", pattern_names[p], capacities[c], size_distributions[s].name,
+                        ops, result.ns_per_op);
+                print_counter(result.per_op[BENCH_CACHE_MISSES]);
+                print_counter(result.per_op[BENCH_INSTRUCTIONS]);
+                printf("\n");
+                fflush(stdout);
+            }
+        }
+    }
+    counters_close();
+    return 0;
+}
@@ -10,8 +10,19 @@
 
 #ifdef __KERNEL__
 #include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/errno.h>
+#include <asm/barrier.h>
+#define aesd_alloc_entries(n) kcalloc(n, sizeof(struct aesd_buffer_entry), GFP_KERNEL)
+#define aesd_free_entries(p) kfree(p)
+#define aesd_wmb() smp_wmb()
 #else
 #include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#define aesd_alloc_entries(n) calloc(n, sizeof(struct aesd_buffer_entry))
+#define aesd_free_entries(p) free(p)
+#define aesd_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
 #endif
 
 #include "aesd-circular-buffer.h"
@@ -29,31 +40,108 @@
 struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn )
 {
-    /**
-    * TODO: implement per description
-    */
-    
-    // Validate input parameters
-    if (buffer == NULL || entry_offset_byte_rtn == NULL) {
+    int index = aesd_circular_buffer_find_index_for_fpos(buffer, char_offset, entry_offset_byte_rtn);
+    if (index < 0) {
         return NULL;
     }
-    
-    size_t current_offs = 0;
-    size_t current_idx = buffer->out_offs;
-    size_t i = 0;
-
-    for(i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++) {
-        if(char_offset >= current_offs && char_offset < (current_offs + buffer->entry[current_idx].size)) {
-            *entry_offset_byte_rtn = char_offset - current_offs;
-            return &buffer->entry[current_idx];
+    return aesd_entry_ring_at(buffer, index);
+}
+
+/**
+ * Same as aesd_circular_buffer_find_entry_offset_for_fpos() but returns the zero referenced index of the
+ * matching entry, counted from the oldest entry, or -1 if char_offset is not available in the buffer.
+ * Entries record their running start offset, so this is a binary search over the stored entries.
+ */
+int aesd_circular_buffer_find_index_for_fpos(struct aesd_circular_buffer *buffer,
+            size_t char_offset, size_t *entry_offset_byte_rtn)
+{
+    size_t start_offs;
+    unsigned int low, high, mid;
+    const struct aesd_buffer_entry *entry;
+
+    // Validate input parameters
+    if (buffer == NULL || entry_offset_byte_rtn == NULL || char_offset >= buffer->total_size) {
+        return -1;
+    }
+
+    // Running offsets only ever grow, so relative to the oldest byte they are sorted
+    start_offs = buffer->end_offs - buffer->total_size;
+    low = 0;
+    high = aesd_circular_buffer_count(buffer) - 1;
+    while (low < high) {
+        mid = low + (high - low + 1) / 2;
+        entry = aesd_entry_ring_at(buffer, mid);
+        if (entry->offs - start_offs <= char_offset) {
+            low = mid;
+        } else {
+            high = mid - 1;
         }
+    }
+
+    entry = aesd_entry_ring_at(buffer, low);
+    *entry_offset_byte_rtn = char_offset - (entry->offs - start_offs);
+    return low;
+}
 
-        current_offs += buffer->entry[current_idx].size;
-        current_idx++;
-        current_idx %= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+/**
+ * @param buffer the buffer to look up.  Any necessary locking must be performed by caller.
+ * @param index the zero referenced index of the entry, counted from the oldest entry
+ * @param fpos_rtn if not NULL, set to the position of the first byte of the entry when all buffer
+ *      strings are concatenated end to end
+ * @return the entry at @param index or NULL if fewer entries are stored
+ */
+struct aesd_buffer_entry *aesd_circular_buffer_get_entry(struct aesd_circular_buffer *buffer,
+            unsigned int index, size_t *fpos_rtn)
+{
+    struct aesd_buffer_entry *entry;
+
+    if (buffer == NULL || index >= aesd_circular_buffer_count(buffer)) {
+        return NULL;
+    }
+    entry = aesd_entry_ring_at(buffer, index);
+    if (fpos_rtn) {
+        *fpos_rtn = entry->offs - (buffer->end_offs - buffer->total_size);
     }
+    return entry;
+}
 
-    return NULL;
+/**
+* Drops the oldest entry of @param buffer
+* @return its buffptr
+*/
+static const char *aesd_circular_buffer_evict(struct aesd_circular_buffer *buffer)
+{
+    struct aesd_buffer_entry *entry = aesd_entry_ring_pop(buffer);
+    const char *bufp = entry->buffptr;
+    buffer->total_size -= entry->size;
+    entry->buffptr = NULL;
+    entry->size = 0;
+    buffer->generation++;
+    return bufp;
+}
+
+/**
+* Copies @param size bytes at @param data to the end of the byte ring of @param buffer, in at
+* most two pieces, after evicting as many of the oldest entries as needed to make room.
+*/
+static void aesd_circular_buffer_ring_write(struct aesd_circular_buffer *buffer, const char *data, size_t size)
+{
+    size_t pos = buffer->end_offs & (buffer->ring_size - 1);
+    size_t chunk = buffer->ring_size - pos;
+
+    while (buffer->total_size + size > buffer->ring_size && aesd_circular_buffer_count(buffer))
+    {
+        aesd_circular_buffer_evict(buffer);
+    }
+    buffer->write_offs = buffer->end_offs + size;
+    aesd_wmb();
+
+    if (chunk > size)
+    {
+        chunk = size;
+    }
+    memcpy(buffer->ring + pos, data, chunk);
+    memcpy(buffer->ring, data + chunk, size - chunk);
 }
 
 /**
@@ -62,37 +150,221 @@ struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct
 * new start location.
 * Any necessary locking must be handled by the caller
 * Any memory referenced in @param add_entry must be allocated by and/or must have a lifetime managed by the caller.
+* With a byte ring attached the contents of @param add_entry are copied into the ring instead,
+* evicting the oldest entries until they fit.  Entries larger than ring_size are not added.
+* @return the buffptr of the entry overwritten, to be released by the caller, or NULL
 */
 const char *aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry)
 {
     const char *bufp = NULL;
-    if (buffer == NULL || add_entry == NULL)
+    struct aesd_buffer_entry *entry;
+    if (buffer == NULL || add_entry == NULL ||
+        (buffer->ring && add_entry->size > buffer->ring_size))
     {
         return NULL;
     }
     
     if(buffer->full)
     {
-        bufp = buffer->entry[buffer->out_offs].buffptr;
+        bufp = aesd_circular_buffer_evict(buffer);
     }
-    buffer->entry[buffer->in_offs] = *add_entry;
-    buffer->in_offs = (buffer->in_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-
-    if (buffer->full)
+    // The ring may evict more entries, so it is written before the new one is counted
+    if (buffer->ring)
     {
-        buffer->out_offs = (buffer->out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        aesd_circular_buffer_ring_write(buffer, add_entry->buffptr, add_entry->size);
     }
-    else if (buffer->in_offs == buffer->out_offs)
+    entry = aesd_entry_ring_push(buffer);
+    *entry = *add_entry;
+    if (buffer->ring)
     {
-        buffer->full = true;
+        entry->buffptr = NULL;
     }
+    entry->offs = buffer->end_offs;
+    buffer->end_offs += add_entry->size;
+    buffer->total_size += add_entry->size;
     return bufp;
 }
 
 /**
-* Initializes the circular buffer described by @param buffer to an empty struct
+* Removes the oldest entry from @param buffer, advancing buffer->out_offs.
+* Any necessary locking must be handled by the caller
+* @return the buffptr of the removed entry, to be released by the caller, or NULL if the buffer is empty
+*/
+const char *aesd_circular_buffer_remove_entry(struct aesd_circular_buffer *buffer)
+{
+    if (buffer == NULL || aesd_circular_buffer_count(buffer) == 0)
+    {
+        return NULL;
+    }
+
+    return aesd_circular_buffer_evict(buffer);
+}
+
+/**
+* @return the number of entries currently stored in @param buffer
+*/
+unsigned int aesd_circular_buffer_count(const struct aesd_circular_buffer *buffer)
+{
+    return aesd_entry_ring_count(buffer);
+}
+
+/**
+* Initializes the circular buffer described by @param buffer to an empty buffer retaining
+* AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries.  The entries are stored in the buffer
+* itself, so this cannot fail and calling aesd_circular_buffer_free() afterwards is optional.
 */
 void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer)
 {
     memset(buffer,0,sizeof(struct aesd_circular_buffer));
+    aesd_entry_ring_init(buffer, buffer->default_slot,
+            sizeof(buffer->default_slot) / sizeof(buffer->default_slot[0]),
+            AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
+}
+
+/**
+* Releases the entry storage of @param buffer unless it is the storage embedded in the buffer
+*/
+static void aesd_circular_buffer_free_slots(struct aesd_circular_buffer *buffer)
+{
+    if (buffer->slot != buffer->default_slot)
+    {
+        aesd_free_entries(buffer->slot);
+    }
+}
+
+/**
+* Initializes the circular buffer described by @param buffer to an empty buffer retaining
+* @param capacity entries. Storage is allocated for capacity rounded up to a power of two
+* slots and must be released with aesd_circular_buffer_free().
+* @return 0 on success, -EINVAL for an unsupported capacity or -ENOMEM
+*/
+int aesd_circular_buffer_init_capacity(struct aesd_circular_buffer *buffer, unsigned int capacity)
+{
+    unsigned int slots;
+    struct aesd_buffer_entry *entries;
+    memset(buffer,0,sizeof(struct aesd_circular_buffer));
+    if (capacity == 0 || capacity > AESDCHAR_MAX_CAPACITY)
+    {
+        return -EINVAL;
+    }
+
+    slots = aesd_ring_roundup_pow_of_two(capacity);
+    entries = aesd_alloc_entries(slots);
+    if (entries == NULL)
+    {
+        return -ENOMEM;
+    }
+    aesd_entry_ring_init(buffer, entries, slots, capacity);
+    return 0;
+}
+
+/**
+* Stores the contents of @param buffer from now on in the byte ring @param ring of
+* @param ring_size bytes, a power of two, owned by the caller.  Only allowed while the
+* buffer is empty.
+* @return 0 on success or -EINVAL
+*/
+int aesd_circular_buffer_attach_ring(struct aesd_circular_buffer *buffer, char *ring, size_t ring_size)
+{
+    if (ring == NULL || ring_size == 0 || (ring_size & (ring_size - 1)) ||
+        aesd_circular_buffer_count(buffer) != 0)
+    {
+        return -EINVAL;
+    }
+    buffer->ring = ring;
+    buffer->ring_size = ring_size;
+    return 0;
+}
+
+/**
+* Initializes @param copy as a buffer retaining @param capacity entries holding the entries of
+* @param buffer, which must not be more than capacity.  Entry contents and any byte ring are
+* shared with @param buffer, whose own entry storage is left untouched.  The generation is
+* advanced, since entries may be at different locations.
+* @return 0 on success, -EINVAL or -ENOMEM
+*/
+int aesd_circular_buffer_init_copy(struct aesd_circular_buffer *copy,
+            const struct aesd_circular_buffer *buffer, unsigned int capacity)
+{
+    if (aesd_circular_buffer_count(buffer) > capacity)
+    {
+        return -EINVAL;
+    }
+    return aesd_circular_buffer_init_copy_newest(copy, buffer, capacity);
+}
+
+/**
+* Same as aesd_circular_buffer_init_copy(), but when @param buffer holds more than
+* @param capacity entries only the newest capacity of them are copied.  @param buffer is
+* left untouched either way, so a caller shrinking a buffer can prepare the copy before
+* it releases anything.
+* @return 0 on success, -EINVAL or -ENOMEM
+*/
+int aesd_circular_buffer_init_copy_newest(struct aesd_circular_buffer *copy,
+            const struct aesd_circular_buffer *buffer, unsigned int capacity)
+{
+    unsigned int count = aesd_circular_buffer_count(buffer);
+    unsigned int first = count > capacity ? count - capacity : 0;
+    unsigned int i;
+    int result;
+
+    result = aesd_circular_buffer_init_capacity(copy, capacity);
+    if (result)
+    {
+        return result;
+    }
+
+    for (i = first; i < count; i++)
+    {
+        const struct aesd_buffer_entry *entry = aesd_entry_ring_peek(buffer, i);
+
+        *aesd_entry_ring_push(copy) = *entry;
+        copy->total_size += entry->size;
+    }
+    copy->end_offs = buffer->end_offs;
+    copy->generation = buffer->generation + 1;
+    copy->ring = buffer->ring;
+    copy->ring_size = buffer->ring_size;
+    copy->write_offs = buffer->write_offs;
+    return 0;
+}
+
+/**
+* Moves the entries of @param buffer into new storage retaining @param capacity entries.
+* The caller must first remove entries with aesd_circular_buffer_remove_entry() until no more
+* than capacity remain. Any necessary locking must be handled by the caller.
+* @return 0 on success, -EINVAL or -ENOMEM leaving the buffer unchanged
+*/
+int aesd_circular_buffer_resize(struct aesd_circular_buffer *buffer, unsigned int capacity)
+{
+    struct aesd_circular_buffer resized;
+    int result = aesd_circular_buffer_init_copy(&resized, buffer, capacity);
+
+    if (result)
+    {
+        return result;
+    }
+    aesd_circular_buffer_free_slots(buffer);
+    *buffer = resized;
+    return 0;
+}
+
+/**
+* Releases the entry storage of @param buffer. Memory referenced by the entries is owned
+* by the caller and must be released first.
+*/
+void aesd_circular_buffer_free(struct aesd_circular_buffer *buffer)
+{
+    aesd_circular_buffer_free_slots(buffer);
+    buffer->slot = NULL;
+    buffer->capacity = 0;
+    buffer->mask = 0;
+    buffer->in_offs = 0;
+    buffer->out_offs = 0;
+    buffer->full = false;
+    buffer->total_size = 0;
+    buffer->end_offs = 0;
+    buffer->ring = NULL;
+    buffer->ring_size = 0;
+    buffer->write_offs = 0;
 }
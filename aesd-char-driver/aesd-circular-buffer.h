@@ -15,57 +15,137 @@
 #include <stdint.h> // uintx_t
 #include <stdbool.h>
 #endif
+#include "aesd-ring.h"
 
+/**
+ * Default number of write operations retained, used by aesd_circular_buffer_init().
+ * Buffers sized at runtime use aesd_circular_buffer_init_capacity() instead.
+ */
+#ifndef AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
 #define AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED 10
+#endif
+
+/**
+ * Largest capacity accepted by aesd_circular_buffer_init_capacity()
+ */
+#define AESDCHAR_MAX_CAPACITY 65536
 
 struct aesd_buffer_entry
 {
     /**
-     * A location where the buffer contents in buffptr are stored
+     * A location where the buffer contents in buffptr are stored.  NULL for entries of a
+     * buffer with a byte ring, whose contents are in the ring at offs.
      */
     const char *buffptr;
     /**
      * Number of bytes stored in buffptr
      */
     size_t size;
+    /**
+     * Running offset of the first byte of this entry, counted from the first byte ever
+     * added to the buffer.  Set by aesd_circular_buffer_add_entry().
+     */
+    size_t offs;
 };
 
 struct aesd_circular_buffer
 {
     /**
-     * An array of pointers to memory allocated for the most recent write operations
+     * The entries of the most recent write operations, an aesd_entry_ring: capacity of
+     * them are retained in mask + 1 slots, oldest at out_offs, and full is set to true
+     * when the buffer holds capacity entries.  See aesd-ring.h.
      */
-    struct aesd_buffer_entry  entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    AESD_RING_MEMBERS(struct aesd_buffer_entry, unsigned int);
     /**
-     * The current location in the entry structure where the next write should
-     * be stored.
+     * Sum of the sizes of all stored entries
      */
-    uint8_t in_offs;
+    size_t total_size;
     /**
-     * The first location in the entry structure to read from
+     * Running offset one past the last byte of the newest entry.  The oldest stored byte
+     * is at end_offs - total_size, so running offsets convert to fpos with a subtraction.
      */
-    uint8_t out_offs;
+    size_t end_offs;
     /**
-     * set to true when the buffer entry structure is full
+     * Incremented whenever stored entries change index: on eviction, removal and resize.
+     * Lets callers cache an entry index and know when it must be looked up again.
      */
-    bool full;
+    unsigned long generation;
+    /**
+     * Optional byte ring of ring_size bytes, a power of two, see
+     * aesd_circular_buffer_attach_ring().  NULL when entries point at their own storage.
+     */
+    char *ring;
+    size_t ring_size;
+    /**
+     * Running offset one past the last ring byte that may have been overwritten.  Set before
+     * ring bytes are written, so a lock-free reader that copied bytes from running offset
+     * o knows they were intact if write_offs <= o + ring_size afterwards.
+     */
+    size_t write_offs;
+    /**
+     * Slots used by a buffer set up with aesd_circular_buffer_init(), so the default
+     * capacity needs no allocation.  A buffer using them must not be copied by value.
+     */
+    struct aesd_buffer_entry default_slot[AESD_RING_ROUNDUP_POW_OF_TWO(AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)];
 };
 
+AESD_RING_DEFINE(aesd_entry_ring, struct aesd_circular_buffer, struct aesd_buffer_entry, unsigned int)
+
 extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn );
 
+extern int aesd_circular_buffer_find_index_for_fpos(struct aesd_circular_buffer *buffer,
+            size_t char_offset, size_t *entry_offset_byte_rtn);
+
+extern struct aesd_buffer_entry *aesd_circular_buffer_get_entry(struct aesd_circular_buffer *buffer,
+            unsigned int index, size_t *fpos_rtn);
+
 extern const char *aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry);
 
+extern const char *aesd_circular_buffer_remove_entry(struct aesd_circular_buffer *buffer);
+
+extern unsigned int aesd_circular_buffer_count(const struct aesd_circular_buffer *buffer);
+
+/**
+ * @return the number of bytes stored in @param buffer, the fpos of SEEK_END
+ */
+static inline size_t aesd_circular_buffer_size(const struct aesd_circular_buffer *buffer)
+{
+    return buffer->total_size;
+}
+
 extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
 
+extern int aesd_circular_buffer_init_capacity(struct aesd_circular_buffer *buffer, unsigned int capacity);
+
+extern int aesd_circular_buffer_attach_ring(struct aesd_circular_buffer *buffer, char *ring, size_t ring_size);
+
+/**
+ * @return the byte at running offset @param offs of the ring of @param buffer
+ */
+static inline char *aesd_circular_buffer_ring_ptr(const struct aesd_circular_buffer *buffer, size_t offs)
+{
+    return buffer->ring + (offs & (buffer->ring_size - 1));
+}
+
+extern int aesd_circular_buffer_init_copy(struct aesd_circular_buffer *copy,
+            const struct aesd_circular_buffer *buffer, unsigned int capacity);
+
+extern int aesd_circular_buffer_init_copy_newest(struct aesd_circular_buffer *copy,
+            const struct aesd_circular_buffer *buffer, unsigned int capacity);
+
+extern int aesd_circular_buffer_resize(struct aesd_circular_buffer *buffer, unsigned int capacity);
+
+extern void aesd_circular_buffer_free(struct aesd_circular_buffer *buffer);
+
 /**
- * Create a for loop to iterate over each member of the circular buffer.
+ * Create a for loop to iterate over each stored entry of the circular buffer, oldest first.
  * Useful when you've allocated memory for circular buffer entries and need to free it
  * @param entryptr is a struct aesd_buffer_entry* to set with the current entry
  * @param buffer is the struct aesd_buffer * describing the buffer
- * @param index is a uint8_t stack allocated value used by this macro for an index
+ * @param index is an unsigned int stack allocated value used by this macro for an index
  * Example usage:
- * uint8_t index;
+ * unsigned int index;
  * struct aesd_circular_buffer buffer;
  * struct aesd_buffer_entry *entry;
  * AESD_CIRCULAR_BUFFER_FOREACH(entry,&buffer,index) {
@@ -73,9 +153,7 @@ extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
  * }
  */
 #define AESD_CIRCULAR_BUFFER_FOREACH(entryptr,buffer,index) \
-    for(index=0, entryptr=&((buffer)->entry[index]); \
-            index<AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; \
-            index++, entryptr=&((buffer)->entry[index]))
+    AESD_RING_FOREACH(aesd_entry_ring, entryptr, buffer, index)
 
 
 
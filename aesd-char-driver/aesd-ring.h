@@ -0,0 +1,186 @@
+/*
+ * aesd-ring.h
+ *
+ * Type generic ring of fixed size slots.  Every instance is generated by macros for its
+ * element type, index type and slot count, so it is specialized at compile time and
+ * builds unchanged in the kernel and in userspace.  aesd_circular_buffer is one
+ * instance, the channels and subscriber queues of aesdsocket are others.
+ *
+ * The number of slots is a power of two, so locations wrap with a mask.  The capacity,
+ * the number of elements retained, may be lower.  Since in_offs == out_offs both for an
+ * empty ring and for a full ring whose capacity equals its slots, full tells them apart.
+ */
+
+#ifndef AESD_RING_H
+#define AESD_RING_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h> // size_t
+#include <stdbool.h>
+#endif
+
+/**
+ * Members of a ring of @param type elements in slots allocated at runtime, indexed with
+ * the unsigned @param index_type.  Place them in the struct an instance is generated for
+ * with AESD_RING_DEFINE().
+ *  slot      mask + 1 slots, oldest element at out_offs, the next one is stored at in_offs
+ *  capacity  number of elements retained, at most mask + 1
+ *  full      set while capacity elements are stored
+ */
+#define AESD_RING_MEMBERS(type, index_type) \
+    type *slot; \
+    index_type capacity; \
+    index_type mask; \
+    index_type in_offs; \
+    index_type out_offs; \
+    bool full
+
+/**
+ * Members of a ring with @param nslots slots, a power of two, embedded in the struct.
+ * Generate its functions with AESD_RING_DEFINE_STATIC().
+ */
+#define AESD_RING_MEMBERS_STATIC(type, index_type, nslots) \
+    type slot[nslots]; \
+    index_type capacity; \
+    index_type in_offs; \
+    index_type out_offs; \
+    bool full
+
+/**
+ * Generates the functions of ring instance @param name for @param ring_type, a struct
+ * holding AESD_RING_MEMBERS(@param type, @param index_type).  Besides the common ones
+ * listed at AESD_RING_DEFINE_OPS() this defines
+ *  void name_init(ring, slots, nslots, capacity)
+ *      empties the ring and points it at @param nslots slots, a power of two, owned by
+ *      the caller, retaining @param capacity <= nslots elements
+ */
+#define AESD_RING_DEFINE(name, ring_type, type, index_type) \
+static inline index_type name##_mask(const ring_type *ring) \
+{ \
+    return ring->mask; \
+} \
+static inline void name##_init(ring_type *ring, type *slots, index_type nslots, \
+        index_type capacity) \
+{ \
+    ring->slot = slots; \
+    ring->mask = nslots - 1; \
+    ring->capacity = capacity; \
+    ring->in_offs = 0; \
+    ring->out_offs = 0; \
+    ring->full = false; \
+} \
+AESD_RING_DEFINE_OPS(name, ring_type, type, index_type)
+
+/**
+ * Generates the functions of ring instance @param name for @param ring_type, a struct
+ * holding AESD_RING_MEMBERS_STATIC(@param type, @param index_type, @param nslots).  The
+ * mask is a compile time constant.  Besides the common ones this defines
+ *  void name_init(ring, capacity)
+ *      empties the ring, retaining @param capacity <= nslots elements
+ */
+#define AESD_RING_DEFINE_STATIC(name, ring_type, type, index_type, nslots) \
+_Static_assert((nslots) > 0 && ((nslots) & ((nslots) - 1)) == 0, \
+        #name " slots must be a power of two"); \
+static inline index_type name##_mask(const ring_type *ring) \
+{ \
+    (void)ring; \
+    return (nslots) - 1; \
+} \
+static inline void name##_init(ring_type *ring, index_type capacity) \
+{ \
+    ring->capacity = capacity; \
+    ring->in_offs = 0; \
+    ring->out_offs = 0; \
+    ring->full = false; \
+} \
+AESD_RING_DEFINE_OPS(name, ring_type, type, index_type)
+
+/**
+ * Functions shared by every instance, any necessary locking is up to the caller:
+ *  index_type name_count(ring)     number of stored elements
+ *  type *name_at(ring, i)          element @param i counted from the oldest, i < count
+ *  const type *name_peek(ring, i)  the same for a const ring, typeof keeps the const on
+ *                                  the element even when type is itself a pointer
+ *  type *name_push(ring)           claims the slot of a new newest element, the ring
+ *                                  must not be full
+ *  type *name_pop(ring)            drops the oldest element and returns its slot, which
+ *                                  stays intact until the next push, or NULL when empty
+ */
+#define AESD_RING_DEFINE_OPS(name, ring_type, type, index_type) \
+static inline index_type name##_count(const ring_type *ring) \
+{ \
+    if (ring->full) { \
+        return ring->capacity; \
+    } \
+    return (index_type)((ring->in_offs - ring->out_offs) & name##_mask(ring)); \
+} \
+static inline type *name##_at(ring_type *ring, index_type i) \
+{ \
+    return &ring->slot[(index_type)(ring->out_offs + i) & name##_mask(ring)]; \
+} \
+static inline const __typeof__(type) *name##_peek(const ring_type *ring, index_type i) \
+{ \
+    return &ring->slot[(index_type)(ring->out_offs + i) & name##_mask(ring)]; \
+} \
+static inline type *name##_push(ring_type *ring) \
+{ \
+    type *slot = &ring->slot[ring->in_offs]; \
+    ring->in_offs = (ring->in_offs + 1) & name##_mask(ring); \
+    if (((ring->in_offs - ring->out_offs) & name##_mask(ring)) == \
+            (ring->capacity & name##_mask(ring))) { \
+        ring->full = true; \
+    } \
+    return slot; \
+} \
+static inline type *name##_pop(ring_type *ring) \
+{ \
+    type *slot; \
+    if (name##_count(ring) == 0) { \
+        return NULL; \
+    } \
+    slot = &ring->slot[ring->out_offs]; \
+    ring->out_offs = (ring->out_offs + 1) & name##_mask(ring); \
+    ring->full = false; \
+    return slot; \
+}
+
+/**
+ * Iterates over the stored elements of ring instance @param name, oldest first.  Empty
+ * slots are skipped.
+ * @param elemptr is a type * set to each element
+ * @param ring is the ring_type * to walk
+ * @param index is an index_type variable used by this macro
+ * Example usage:
+ * AESD_RING_FOREACH(aesd_entry_ring, entry, &buffer, index) {
+ *      free(entry->buffptr);
+ * }
+ */
+#define AESD_RING_FOREACH(name, elemptr, ring, index) \
+    for ((index) = 0; \
+            (index) < name##_count(ring) && ((elemptr) = name##_at((ring), (index)), 1); \
+            (index)++)
+
+/**
+ * @return the smallest power of two greater than or equal to @param n, the slots needed
+ *      to retain n elements
+ */
+static inline size_t aesd_ring_roundup_pow_of_two(size_t n)
+{
+    size_t slots = 1;
+    while (slots < n) {
+        slots <<= 1;
+    }
+    return slots;
+}
+
+/**
+ * Compile time form of aesd_ring_roundup_pow_of_two() for @param n in 1 ... 2^32, usable
+ * to size static slot arrays
+ */
+#define AESD_RING_ROUNDUP_POW_OF_TWO(n) \
+    ((((n) - 1) | ((n) - 1) >> 1 | ((n) - 1) >> 2 | ((n) - 1) >> 4 | ((n) - 1) >> 8 | \
+      ((n) - 1) >> 16) + 1)
+
+#endif /* AESD_RING_H */
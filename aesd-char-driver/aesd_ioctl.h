@@ -38,9 +38,191 @@ struct aesd_seekto {
 
 // Define a write command from the user point of view, use command number 1
 #define AESDCHAR_IOCSEEKTO _IOWR(AESD_IOC_MAGIC, 1, struct aesd_seekto)
+// Set the number of write commands retained by the device.  Only allowed while the device
+// is idle: no other open file and no partially written command.  When shrinking, the oldest
+// commands beyond the new capacity are discarded.
+#define AESDCHAR_IOCSETCAPACITY _IOW(AESD_IOC_MAGIC, 2, uint32_t)
+// Turn tail mode of this open file on (non zero) or off.  In tail mode a read at the end of
+// the data sleeps until a new command is written instead of returning 0, or fails with
+// EAGAIN for O_NONBLOCK files.  Commands evicted while the reader was behind are skipped.
+#define AESDCHAR_IOCSETTAIL _IOW(AESD_IOC_MAGIC, 3, uint32_t)
+/**
+ * Layout of the read-only mapping of the device (mmap offset 0), present when the module
+ * is loaded with a non zero aesd_mmap_size or aesd_ring_size, both 0 by default.  The
+ * first page holds struct aesd_mmap_header, followed at data_offset by a ring of
+ * data_size bytes (a power of two) mirroring the stream of commands: the byte at running
+ * offset offs is at data[offs & (data_size - 1)].
+ * Running offsets count every byte ever written, see struct aesd_buffer_entry.
+ *
+ * Commands first_cmd..next_cmd-1 are readable, command n being described by
+ * entries[n % AESD_MMAP_MAX_ENTRIES].  The writer updates the mapping under a sequence
+ * count: readers sample seq with aesd_mmap_read_begin(), read what they need and start
+ * over if aesd_mmap_read_retry() reports that a writer changed the mapping meanwhile.
+ */
+#define AESD_MMAP_MAGIC 0x44534541	/* "AESD" */
+#define AESD_MMAP_VERSION 1
+#define AESD_MMAP_MAX_ENTRIES 128
+
+struct aesd_mmap_entry {
+    uint64_t offs;	/* running offset of the first byte */
+    uint64_t size;
+};
+
+struct aesd_mmap_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;	/* odd while the writer updates the mapping */
+    uint32_t max_entries;
+    uint64_t data_offset;
+    uint64_t data_size;
+    uint64_t first_cmd;
+    uint64_t next_cmd;
+    uint64_t end_offs;	/* running offset one past the newest byte */
+    struct aesd_mmap_entry entries[AESD_MMAP_MAX_ENTRIES];
+};
+
+#ifndef __KERNEL__
+static inline uint32_t aesd_mmap_read_begin(const struct aesd_mmap_header *hdr)
+{
+    uint32_t seq;
+    while ((seq = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE)) & 1) {
+    }
+    return seq;
+}
+
+static inline int aesd_mmap_read_retry(const struct aesd_mmap_header *hdr, uint32_t seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&hdr->seq, __ATOMIC_RELAXED) != seq;
+}
+#endif
+
+/**
+ * Memory use of the device, returned by AESDCHAR_IOCGSTATS
+ */
+struct aesd_stats {
+    uint64_t bytes;	/* bytes of the stored commands */
+    uint64_t entries;	/* stored commands */
+    uint64_t evictions;	/* commands dropped to make room since the module was loaded */
+    uint64_t pending_bytes;	/* bytes of the command partially written through this file */
+    uint64_t max_bytes;	/* byte budget of the stored commands, 0 for none */
+    uint32_t capacity;	/* most commands retained */
+    uint32_t reserved;
+};
+
+#define AESDCHAR_IOCGSTATS _IOR(AESD_IOC_MAGIC, 4, struct aesd_stats)
+
+/**
+ * Describes one command returned by AESDCHAR_IOCREADENTRIES
+ */
+struct aesd_entry_desc {
+    uint32_t index;	/* zero referenced command index, as used by AESDCHAR_IOCSEEKTO */
+    uint32_t reserved;
+    uint64_t fpos;	/* file position of the first byte of the command */
+    uint64_t size;
+    uint64_t data_offset;	/* offset of the payload within the user buffer */
+};
+
+/**
+ * Reads up to max_count commands starting at command index start in one call.  The user
+ * buffer of buf_size bytes at buf is filled with count struct aesd_entry_desc followed by
+ * the payloads of those commands, back to back.  Only whole commands are returned, as many
+ * as fit; a buffer too small for even the first one fails with ENOSPC.  count is 0 when no
+ * command has index start or max_count is 0.
+ */
+struct aesd_read_entries {
+    uint32_t start;	/* in */
+    uint32_t max_count;	/* in, at most AESD_READ_ENTRIES_MAX are returned per call */
+    uint64_t buf;	/* in, user pointer */
+    uint64_t buf_size;	/* in */
+    uint32_t count;	/* out */
+    uint32_t reserved;
+    uint64_t bytes;	/* out, bytes of buf filled */
+};
+
+#define AESD_READ_ENTRIES_MAX 256
+
+#define AESDCHAR_IOCREADENTRIES _IOWR(AESD_IOC_MAGIC, 5, struct aesd_read_entries)
+
+/**
+ * A match returned by AESDCHAR_IOCSEARCH
+ */
+struct aesd_search_match {
+    uint32_t index;	/* zero referenced command index, as used by AESDCHAR_IOCSEEKTO */
+    uint32_t offset;	/* offset of the match within the command */
+    uint64_t fpos;	/* file position of the match */
+};
+
+/**
+ * Searches the stored commands for the pattern_len bytes at pattern without copying them
+ * out.  The matches array at matches is filled with count (index, offset) pairs of every
+ * position the pattern starts at, in order, beginning at byte start_offset of command
+ * start.  A match never spans two commands.
+ *
+ * Each call searches up to AESD_SEARCH_ENTRIES_MAX commands, all sampled at the same
+ * instant, and returns up to max_matches matches.  start and start_offset are then moved
+ * to where the next call continues, and done is set once the newest command has been
+ * searched, so a whole device is searched with
+ *     while (!search.done) ioctl(fd, AESDCHAR_IOCSEARCH, &search);
+ * Commands evicted between two calls shift the indexes, like for AESDCHAR_IOCREADENTRIES.
+ */
+struct aesd_search {
+    uint64_t pattern;	/* in, user pointer */
+    uint32_t pattern_len;	/* in, 1 to AESD_SEARCH_PATTERN_MAX */
+    uint32_t max_matches;	/* in, at most AESD_SEARCH_MATCHES_MAX are returned per call */
+    uint64_t matches;	/* in, user pointer to max_matches struct aesd_search_match */
+    uint32_t start;	/* in/out */
+    uint32_t start_offset;	/* in/out */
+    uint32_t count;	/* out */
+    uint32_t done;	/* out */
+};
+
+#define AESD_SEARCH_PATTERN_MAX 256
+#define AESD_SEARCH_MATCHES_MAX 256
+#define AESD_SEARCH_ENTRIES_MAX 256
+
+#define AESDCHAR_IOCSEARCH _IOWR(AESD_IOC_MAGIC, 6, struct aesd_search)
+
+/**
+ * Snapshot of a device for warm restarts, e.g. across a module reload.
+ * AESDCHAR_IOCEXPORT serializes every stored command, plus the partial command pending
+ * on the calling file, into the user buffer of buf_size bytes at buf.  If the buffer is
+ * too small it fails with ENOSPC, and bytes still reports the size needed, so a call
+ * with buf_size 0 just sizes the snapshot.
+ *
+ * AESDCHAR_IOCIMPORT replaces the commands of the device with those of a snapshot and
+ * makes its partial command the pending command of the calling file, in one call.  Like
+ * AESDCHAR_IOCSETCAPACITY it requires an idle device.  Imported commands are stored like
+ * written ones, so the capacity, byte ring and byte budget of the importing device apply.
+ * Nothing is changed when the snapshot is rejected.
+ *
+ * A snapshot is a struct aesd_snapshot_header, then count + 1 uint64_t sizes (the
+ * commands oldest first, then the partial command, 0 when there is none), then the
+ * payloads back to back in the same order.
+ */
+#define AESD_SNAPSHOT_MAGIC 0x50534541	/* "AESP" */
+#define AESD_SNAPSHOT_VERSION 1
+
+struct aesd_snapshot_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;	/* stored commands, at most AESDCHAR_MAX_CAPACITY */
+    uint32_t capacity;	/* capacity of the exporting device, informational */
+    uint64_t bytes;	/* size of the whole snapshot */
+};
+
+struct aesd_snapshot {
+    uint64_t buf;	/* in, user pointer */
+    uint64_t buf_size;	/* in */
+    uint64_t bytes;	/* out, size of the snapshot exported or imported */
+};
+
+#define AESDCHAR_IOCEXPORT _IOWR(AESD_IOC_MAGIC, 7, struct aesd_snapshot)
+#define AESDCHAR_IOCIMPORT _IOWR(AESD_IOC_MAGIC, 8, struct aesd_snapshot)
+
 /**
  * The maximum number of commands supported, used for bounds checking
  */
-#define AESDCHAR_IOC_MAXNR 1
+#define AESDCHAR_IOC_MAXNR 8
 
 #endif /* AESD_IOCTL_H */
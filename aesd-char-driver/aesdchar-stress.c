@@ -0,0 +1,172 @@
+/**
+ * @file    aesdchar-stress.c
+ * @brief   Reader heavy stress test for the aesdchar driver. One writer keeps appending
+ *          commands while 1..N reader threads each re-read the whole device through their
+ *          own file descriptor. Prints the aggregate read throughput for every reader count,
+ *          which should grow with the number of cores since readers never take the device
+ *          lock. Everything read back is also checked to be data the writer produced.
+ *
+ *          Usage: aesdchar-stress [device] [seconds per step] [max readers]
+ *
+ * @author  Suhas-Reddy-S
+ **/
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STRESS_READ_SIZE 4096
+#define STRESS_CMD_MAX 32
+
+static const char *device = "/dev/aesdchar";
+static atomic_bool stop;
+static atomic_bool failed;
+
+struct reader_stats {
+    pthread_t thread;
+    unsigned long long bytes;
+    unsigned long long passes;
+};
+
+/*
+ * Commands look like "stress <n>\n". Eviction between two reads legitimately shifts the
+ * data under a file position, so lines may come back cut, but a byte outside this
+ * alphabet means a reader copied from a freed or half written command.
+ */
+static bool valid_bytes(const char *data, size_t len)
+{
+    return strspn(data, "stres 0123456789\n") >= len;
+}
+
+static void *writer_thread(void *arg)
+{
+    unsigned long long n = 0;
+    char cmd[STRESS_CMD_MAX];
+    int fd = open(device, O_WRONLY);
+    (void)arg;
+
+    if (fd < 0) {
+        perror("open writer");
+        atomic_store(&failed, true);
+        return NULL;
+    }
+    while (!atomic_load(&stop)) {
+        int len = snprintf(cmd, sizeof(cmd), "stress %llu\n", n);
+        if (write(fd, cmd, len) != len) {
+            perror("write");
+            atomic_store(&failed, true);
+            break;
+        }
+        n++;
+    }
+    close(fd);
+    return NULL;
+}
+
+static void *reader_thread(void *arg)
+{
+    struct reader_stats *stats = arg;
+    char buf[STRESS_READ_SIZE + 1];
+    ssize_t rc;
+    int fd = open(device, O_RDONLY);
+
+    if (fd < 0) {
+        perror("open reader");
+        atomic_store(&failed, true);
+        return NULL;
+    }
+    while (!atomic_load(&stop)) {
+        rc = read(fd, buf, STRESS_READ_SIZE);
+        if (rc < 0) {
+            perror("read");
+            atomic_store(&failed, true);
+            break;
+        }
+        if (rc == 0) {
+            // Start over from the oldest command once the end is reached
+            stats->passes++;
+            lseek(fd, 0, SEEK_SET);
+            continue;
+        }
+        buf[rc] = '\0';
+        if (!valid_bytes(buf, rc)) {
+            fprintf(stderr, "corrupt data read: %s\n", buf);
+            atomic_store(&failed, true);
+            break;
+        }
+        stats->bytes += rc;
+    }
+    close(fd);
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int seconds = 2;
+    long max_readers = sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_t writer;
+
+    if (argc > 1) {
+        device = argv[1];
+    }
+    if (argc > 2) {
+        seconds = strtoul(argv[2], NULL, 10);
+    }
+    if (argc > 3) {
+        max_readers = strtol(argv[3], NULL, 10);
+    }
+    if (max_readers < 1) {
+        max_readers = 1;
+    }
+
+    struct reader_stats *readers = calloc(max_readers, sizeof(struct reader_stats));
+    if (!readers) {
+        return 1;
+    }
+
+    printf("readers,seconds,bytes,passes,MiB/s\n");
+    // Double the readers each step, always finishing with max_readers
+    for (long count = 1; count <= max_readers && !atomic_load(&failed);
+            count = count < max_readers && count * 2 > max_readers ? max_readers : count * 2) {
+        atomic_store(&stop, false);
+        memset(readers, 0, max_readers * sizeof(struct reader_stats));
+        pthread_create(&writer, NULL, writer_thread, NULL);
+        double begin = now();
+        for (long i = 0; i < count; i++) {
+            pthread_create(&readers[i].thread, NULL, reader_thread, &readers[i]);
+        }
+        sleep(seconds);
+        atomic_store(&stop, true);
+
+        unsigned long long bytes = 0, passes = 0;
+        for (long i = 0; i < count; i++) {
+            pthread_join(readers[i].thread, NULL);
+            bytes += readers[i].bytes;
+            passes += readers[i].passes;
+        }
+        double elapsed = now() - begin;
+        pthread_join(writer, NULL);
+        printf("%ld,%.3f,%llu,%llu,%.1f\n", count, elapsed, bytes, passes,
+                bytes / elapsed / (1024 * 1024));
+    }
+
+    free(readers);
+    if (atomic_load(&failed)) {
+        fprintf(stderr, "FAILED\n");
+        return 1;
+    }
+    return 0;
+}
@@ -9,30 +9,112 @@
 #ifndef AESD_CHAR_DRIVER_AESDCHAR_H_
 #define AESD_CHAR_DRIVER_AESDCHAR_H_
 
-#define AESD_DEBUG 1  //Remove comment on this line to enable debug
-
 #undef PDEBUG             /* undef it, just in case */
-#ifdef AESD_DEBUG
-#  ifdef __KERNEL__
-     /* This one if debugging is on, and kernel space */
-#    define PDEBUG(fmt, args...) printk( KERN_DEBUG "aesdchar: " fmt, ## args)
-#  else
+#ifdef __KERNEL__
+     /* Always built, printed only when enabled through dynamic debug */
+#  define PDEBUG(fmt, args...) pr_debug("aesdchar: " fmt, ## args)
+#elif defined(AESD_DEBUG)
      /* This one for user space */
-#    define PDEBUG(fmt, args...) fprintf(stderr, fmt, ## args)
-#  endif
+#  define PDEBUG(fmt, args...) fprintf(stderr, fmt, ## args)
 #else
 #  define PDEBUG(fmt, args...) /* not debugging: nothing */
 #endif
 
+/* Smallest allocation for a pending command, later grown geometrically */
+#define AESD_PENDING_MIN_ALLOC 64
+
+/*
+ * Allocation backing every command buffer: buffptr of an entry points at data.  Evicted
+ * commands are freed through rcu only after an SRCU grace period, since lock-free readers
+ * may still be copying from them.
+ */
+struct aesd_cmd
+{
+    struct rcu_head rcu;
+    unsigned char cache;	/* size class it came from or AESD_CMD_KMALLOC */
+    char data[];
+};
+
+#define AESD_CMD_KMALLOC 0xff
+
+/*
+ * Event counters of a device, one copy per CPU so hot paths never share a cache line for
+ * them.  Readers sum all copies, see aesd_counters_sum().
+ */
+struct aesd_counters
+{
+    u64 write_bytes;	/* bytes of completed commands */
+    u64 write_cmds;	/* completed commands */
+    u64 reads;	/* read calls */
+    u64 read_bytes;
+    u64 evictions;	/* commands dropped to make room */
+    u64 fragments;	/* writes that left a partial command pending */
+    u64 lock_wait_ns;	/* time writers waited for a contended device lock */
+};
+
 struct aesd_dev
 {
     /**
      * TODO: Add structure(s) and locks needed to complete assignment requirements
      */
     struct cdev cdev;     /* Char device structure      */
-    struct aesd_buffer_entry entry;	
-    struct aesd_circular_buffer buf;	
-    struct mutex lock;
+    /*
+     * Writers hold lock and bracket every change of buf with seq.  Readers take no lock:
+     * they sample buf inside an srcu read section and retry when seq shows a writer raced.
+     * buf itself is only replaced by a resize, after which the old one is freed once
+     * readers are done with it.
+     */
+    struct aesd_circular_buffer __rcu *buf;
+    struct mutex lock;	/* serializes writers */
+    seqcount_mutex_t seq;
+    struct srcu_struct srcu;
+    wait_queue_head_t wait;	/* woken on every completed command */
+    /*
+     * Read-only mapping of the newest commands, see struct aesd_mmap_header.  NULL when
+     * mmap is disabled.  Updated by writers under lock.
+     */
+    struct aesd_mmap_header *mmap_hdr;
+    char *mmap_data;
+    size_t ring_size;	/* size of the byte ring of buf, 0 without one; fixed at load */
+    struct aesd_counters __percpu *counters;
+    struct device *device;	/* sysfs node, see aesd_dev_attrs */
+    atomic_t open_count;  /* files currently holding the device open */
+};
+
+/*
+ * Per open file state, stored in filp->private_data
+ */
+struct aesd_file
+{
+    struct aesd_dev *dev;
+    /*
+     * Read cursor cached by the last read or seek: the entry index (counted from the
+     * oldest entry) and byte within it that correspond to cursor_fpos.  Only valid while
+     * the buffer generation still equals cursor_generation, i.e. nothing was evicted.
+     * Protected by cursor_lock, which only serializes users of this open file.
+     */
+    struct mutex cursor_lock;
+    bool cursor_valid;
+    loff_t cursor_fpos;
+    unsigned int cursor_index;
+    size_t cursor_offset;
+    unsigned long cursor_generation;
+    /*
+     * Running offset (see struct aesd_buffer_entry) of f_pos as of the last read or seek.
+     * Unlike f_pos it does not shift on eviction, so it tells poll and tail reads whether
+     * anything new was written.
+     */
+    size_t pos_offs;
+    bool tail;	/* reads at the end wait for new data, see AESDCHAR_IOCSETTAIL */
+    /*
+     * Command being assembled from partial writes through this file.  Staging it here
+     * instead of in the device keeps writers on different files from contending or
+     * interleaving their partial commands; the device lock is only taken to publish a
+     * completed command.  Lock order is pending_lock, then the device lock.
+     */
+    struct mutex pending_lock;
+    struct aesd_buffer_entry entry;
+    size_t entry_alloc;	/* bytes allocated at entry.buffptr */
 };
 
 
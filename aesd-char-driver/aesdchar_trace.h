@@ -0,0 +1,160 @@
+/*
+ * aesdchar_trace.h
+ *
+ * Tracepoints of the aesdchar driver, under events/aesdchar/ in tracefs.  Each event
+ * carries the minor number of the device so several instances can be told apart.
+ * Disabled tracepoints cost a patched out branch, nothing is formatted until a tracer
+ * reads the event.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM aesdchar
+
+#if !defined(AESD_CHAR_DRIVER_AESDCHAR_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define AESD_CHAR_DRIVER_AESDCHAR_TRACE_H_
+
+#include <linux/tracepoint.h>
+#include <linux/kdev_t.h>
+#include "aesdchar.h"
+
+/*
+ * A write of @count bytes starts, with @pending bytes of a partial command already
+ * staged by the same file
+ */
+TRACE_EVENT(aesd_write_entry,
+	TP_PROTO(struct aesd_dev *devp, size_t count, size_t pending),
+	TP_ARGS(devp, count, pending),
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(size_t, count)
+		__field(size_t, pending)
+	),
+	TP_fast_assign(
+		__entry->minor = MINOR(devp->cdev.dev);
+		__entry->count = count;
+		__entry->pending = pending;
+	),
+	TP_printk("minor=%u count=%zu pending=%zu",
+		__entry->minor, __entry->count, __entry->pending)
+);
+
+/*
+ * A completed command of @size bytes was added at running offset @offs, leaving @entries
+ * stored.  @lock_wait_ns is how long the writer waited for the device lock, 0 when it was
+ * free.
+ */
+TRACE_EVENT(aesd_write_commit,
+	TP_PROTO(struct aesd_dev *devp, size_t size, size_t offs, unsigned int entries,
+		u64 lock_wait_ns),
+	TP_ARGS(devp, size, offs, entries, lock_wait_ns),
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(size_t, size)
+		__field(size_t, offs)
+		__field(unsigned int, entries)
+		__field(u64, lock_wait_ns)
+	),
+	TP_fast_assign(
+		__entry->minor = MINOR(devp->cdev.dev);
+		__entry->size = size;
+		__entry->offs = offs;
+		__entry->entries = entries;
+		__entry->lock_wait_ns = lock_wait_ns;
+	),
+	TP_printk("minor=%u size=%zu offs=%zu entries=%u lock_wait_ns=%llu",
+		__entry->minor, __entry->size, __entry->offs, __entry->entries,
+		__entry->lock_wait_ns)
+);
+
+/*
+ * Adding a command evicted the @count oldest ones, @bytes in total.  The oldest stored
+ * byte is now at running offset @start_offs.
+ */
+TRACE_EVENT(aesd_evict,
+	TP_PROTO(struct aesd_dev *devp, unsigned int count, size_t bytes, size_t start_offs),
+	TP_ARGS(devp, count, bytes, start_offs),
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(unsigned int, count)
+		__field(size_t, bytes)
+		__field(size_t, start_offs)
+	),
+	TP_fast_assign(
+		__entry->minor = MINOR(devp->cdev.dev);
+		__entry->count = count;
+		__entry->bytes = bytes;
+		__entry->start_offs = start_offs;
+	),
+	TP_printk("minor=%u count=%u bytes=%zu start_offs=%zu",
+		__entry->minor, __entry->count, __entry->bytes, __entry->start_offs)
+);
+
+/*
+ * A read of @count bytes at @f_pos returned @result and stopped in entry @index
+ */
+TRACE_EVENT(aesd_read,
+	TP_PROTO(struct aesd_dev *devp, loff_t f_pos, size_t count, ssize_t result,
+		unsigned int index),
+	TP_ARGS(devp, f_pos, count, result, index),
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(loff_t, f_pos)
+		__field(size_t, count)
+		__field(ssize_t, result)
+		__field(unsigned int, index)
+	),
+	TP_fast_assign(
+		__entry->minor = MINOR(devp->cdev.dev);
+		__entry->f_pos = f_pos;
+		__entry->count = count;
+		__entry->result = result;
+		__entry->index = index;
+	),
+	TP_printk("minor=%u f_pos=%lld count=%zu result=%zd index=%u",
+		__entry->minor, __entry->f_pos, __entry->count, __entry->result, __entry->index)
+);
+
+TRACE_EVENT(aesd_llseek,
+	TP_PROTO(struct aesd_dev *devp, loff_t off, int whence, loff_t f_pos),
+	TP_ARGS(devp, off, whence, f_pos),
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(loff_t, off)
+		__field(int, whence)
+		__field(loff_t, f_pos)
+	),
+	TP_fast_assign(
+		__entry->minor = MINOR(devp->cdev.dev);
+		__entry->off = off;
+		__entry->whence = whence;
+		__entry->f_pos = f_pos;
+	),
+	TP_printk("minor=%u off=%lld whence=%d f_pos=%lld",
+		__entry->minor, __entry->off, __entry->whence, __entry->f_pos)
+);
+
+TRACE_EVENT(aesd_ioctl,
+	TP_PROTO(struct aesd_dev *devp, unsigned int cmd, long result),
+	TP_ARGS(devp, cmd, result),
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(unsigned int, cmd)
+		__field(long, result)
+	),
+	TP_fast_assign(
+		__entry->minor = MINOR(devp->cdev.dev);
+		__entry->cmd = cmd;
+		__entry->result = result;
+	),
+	TP_printk("minor=%u cmd=%#x nr=%u result=%ld",
+		__entry->minor, __entry->cmd, _IOC_NR(__entry->cmd), __entry->result)
+);
+
+#endif /* AESD_CHAR_DRIVER_AESDCHAR_TRACE_H_ */
+
+/* This part must be outside protection, main.c builds with -I$(src) to find it */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE aesdchar_trace
+#include <trace/define_trace.h>
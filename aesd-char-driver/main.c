@@ -19,7 +19,27 @@
 #include <linux/types.h>
 #include <linux/cdev.h>
 #include <linux/fs.h> // file_operations
+#include <linux/moduleparam.h>
+#include <linux/srcu.h>
+#include <linux/seqlock.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/version.h>
+#include <linux/uio.h>
+#include <linux/splice.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/device.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>
+#include <linux/sched.h>
 #include "aesdchar.h"
+#define CREATE_TRACE_POINTS
+#include "aesdchar_trace.h"
 #include <linux/slab.h>
 #include "aesd_ioctl.h"
 
@@ -38,228 +58,1652 @@ typedef enum {
 int aesd_major =   0; // use dynamic major
 int aesd_minor =   0;
 
+static unsigned int aesd_nr_devs = 1;
+module_param(aesd_nr_devs, uint, S_IRUGO);
+MODULE_PARM_DESC(aesd_nr_devs, "Number of independent aesdchar devices, each with its own buffer");
+
+static unsigned int aesd_max_entries = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+module_param(aesd_max_entries, uint, S_IRUGO);
+MODULE_PARM_DESC(aesd_max_entries, "Number of write commands retained by the device");
+
+// Off by default: mirroring costs every write an extra copy even while nothing maps the device
+static unsigned int aesd_mmap_size;
+module_param(aesd_mmap_size, uint, S_IRUGO);
+MODULE_PARM_DESC(aesd_mmap_size, "Bytes of command data mirrored for mmap readers, 0 (default) disables mmap");
+
+static unsigned int aesd_ring_size;
+module_param(aesd_ring_size, uint, S_IRUGO);
+MODULE_PARM_DESC(aesd_ring_size, "Store commands in one byte ring of this size instead of an allocation each, 0 disables");
+
+static unsigned long aesd_max_bytes;
+module_param(aesd_max_bytes, ulong, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(aesd_max_bytes, "Byte budget of the stored commands, the oldest are evicted to stay within it, 0 disables");
+
 MODULE_AUTHOR("Suhas Reddy S"); /** TODO: fill in your name **/
 MODULE_LICENSE("Dual BSD/GPL");
 
-struct aesd_dev aesd_device;
+struct aesd_dev *aesd_devices;	/* aesd_nr_devs devices, minor aesd_minor + index */
+
+/*
+ * The buffer a writer holding devp->lock works on
+ */
+static struct aesd_circular_buffer *aesd_locked_buf(struct aesd_dev *devp)
+{
+	return rcu_dereference_protected(devp->buf, lockdep_is_held(&devp->lock));
+}
+
+static struct aesd_cmd *aesd_cmd_of(const char *buffptr)
+{
+	return (struct aesd_cmd *)(buffptr - offsetof(struct aesd_cmd, data));
+}
+
+/*
+ * Size classes of small commands, each served by its own kmem_cache.  Sizes include the
+ * struct aesd_cmd header, larger commands come from kmalloc.
+ */
+static struct {
+	const char *name;
+	unsigned int size;
+	struct kmem_cache *cache;
+} aesd_cmd_classes[] = {
+	{ "aesd_cmd_64", 64 },
+	{ "aesd_cmd_128", 128 },
+	{ "aesd_cmd_256", 256 },
+	{ "aesd_cmd_512", 512 },
+	{ "aesd_cmd_1024", 1024 },
+};
+
+static void aesd_cmd_caches_destroy(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(aesd_cmd_classes); i++) {
+		kmem_cache_destroy(aesd_cmd_classes[i].cache);
+		aesd_cmd_classes[i].cache = NULL;
+	}
+}
+
+static int aesd_cmd_caches_init(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(aesd_cmd_classes); i++) {
+		aesd_cmd_classes[i].cache = kmem_cache_create(aesd_cmd_classes[i].name,
+				aesd_cmd_classes[i].size, 0, 0, NULL);
+		if (!aesd_cmd_classes[i].cache) {
+			aesd_cmd_caches_destroy();
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+/*
+ * @return the size class holding a command of @size bytes or AESD_CMD_KMALLOC
+ */
+static unsigned char aesd_cmd_class(size_t size)
+{
+	unsigned char i;
+
+	for (i = 0; i < ARRAY_SIZE(aesd_cmd_classes); i++) {
+		if (sizeof(struct aesd_cmd) + size <= aesd_cmd_classes[i].size) {
+			return i;
+		}
+	}
+	return AESD_CMD_KMALLOC;
+}
+
+static void aesd_cmd_destroy(struct aesd_cmd *cmd)
+{
+	if (cmd->cache == AESD_CMD_KMALLOC) {
+		kfree(cmd);
+	} else {
+		kmem_cache_free(aesd_cmd_classes[cmd->cache].cache, cmd);
+	}
+}
+
+static void aesd_cmd_free_rcu(struct rcu_head *head)
+{
+	aesd_cmd_destroy(container_of(head, struct aesd_cmd, rcu));
+}
+
+/*
+ * Frees a command evicted from the buffer of @devp once no reader can still be copying it
+ */
+static void aesd_cmd_release(struct aesd_dev *devp, const char *buffptr)
+{
+	if (buffptr) {
+		call_srcu(&devp->srcu, &aesd_cmd_of(buffptr)->rcu, aesd_cmd_free_rcu);
+	}
+}
+
+/*
+ * Frees a command no reader can reach
+ */
+static void aesd_cmd_free(const char *buffptr)
+{
+	if (buffptr) {
+		aesd_cmd_destroy(aesd_cmd_of(buffptr));
+	}
+}
+
+int aesd_open(struct inode *inode, struct file *filp)
+{
+    PDEBUG("open");
+    /**
+     * TODO: handle open
+     */
+    struct aesd_file *file = kzalloc(sizeof(struct aesd_file), GFP_KERNEL);
+    if (!file) {
+        return -ENOMEM;
+    }
+    file->dev = container_of(inode->i_cdev, struct aesd_dev, cdev);
+    mutex_init(&file->cursor_lock);
+    mutex_init(&file->pending_lock);
+    atomic_inc(&file->dev->open_count);
+    filp->private_data = file;
+    return 0;
+}
+
+int aesd_release(struct inode *inode, struct file *filp)
+{
+    PDEBUG("release");
+    /**
+     * TODO: handle release
+     */
+    struct aesd_file *file = filp->private_data;
+    atomic_dec(&file->dev->open_count);
+    mutex_destroy(&file->cursor_lock);
+    // A partial command never completed by this file is dropped with it
+    aesd_cmd_free(file->entry.buffptr);
+    mutex_destroy(&file->pending_lock);
+    kfree(file);
+    filp->private_data = NULL;
+    return 0;
+}
+
+/*
+ * Allocates the mapping of @devp with a data ring of at least @data_size bytes
+ */
+static int aesd_mmap_init(struct aesd_dev *devp, size_t data_size)
+{
+	struct aesd_mmap_header *hdr;
+
+	BUILD_BUG_ON(sizeof(struct aesd_mmap_header) > PAGE_SIZE);
+	if (!data_size) {
+		return 0;
+	}
+	data_size = roundup_pow_of_two(max_t(size_t, data_size, PAGE_SIZE));
+	hdr = vmalloc_user(PAGE_SIZE + data_size);
+	if (!hdr) {
+		return -ENOMEM;
+	}
+	hdr->magic = AESD_MMAP_MAGIC;
+	hdr->version = AESD_MMAP_VERSION;
+	hdr->max_entries = AESD_MMAP_MAX_ENTRIES;
+	hdr->data_offset = PAGE_SIZE;
+	hdr->data_size = data_size;
+	devp->mmap_hdr = hdr;
+	devp->mmap_data = (char *)hdr + PAGE_SIZE;
+	return 0;
+}
+
+static void aesd_mmap_write_begin(struct aesd_mmap_header *hdr)
+{
+	WRITE_ONCE(hdr->seq, hdr->seq + 1);
+	smp_wmb();
+}
+
+static void aesd_mmap_write_end(struct aesd_mmap_header *hdr)
+{
+	smp_wmb();
+	WRITE_ONCE(hdr->seq, hdr->seq + 1);
+}
+
+/*
+ * Drops commands from the mapping that were evicted from the device, which now starts at
+ * running offset @start_offs, or whose bytes the data ring no longer holds
+ */
+static void aesd_mmap_trim(struct aesd_mmap_header *hdr, size_t start_offs)
+{
+	uint64_t valid_offs = hdr->end_offs > hdr->data_size ? hdr->end_offs - hdr->data_size : 0;
+
+	valid_offs = max_t(uint64_t, valid_offs, start_offs);
+	while (hdr->first_cmd < hdr->next_cmd &&
+			(hdr->next_cmd - hdr->first_cmd > AESD_MMAP_MAX_ENTRIES ||
+			 hdr->entries[hdr->first_cmd % AESD_MMAP_MAX_ENTRIES].offs < valid_offs)) {
+		hdr->first_cmd++;
+	}
+}
+
+/*
+ * Mirrors the command @cmd of @size bytes starting at running offset @offs into the
+ * mapping of @devp.  The data ring is written with at most two copies, or not at all when
+ * @cmd is NULL because the device stores commands in the mapped ring itself.  Caller holds
+ * the device lock.
+ */
+static void aesd_mmap_commit(struct aesd_dev *devp, const char *cmd, size_t size, size_t offs,
+		size_t start_offs)
+{
+	struct aesd_mmap_header *hdr = devp->mmap_hdr;
+	size_t mask, skip, pos, chunk;
+
+	if (!hdr) {
+		return;
+	}
+	mask = hdr->data_size - 1;
+	// Only the tail of a command larger than the ring fits, the entry is trimmed below
+	skip = size > hdr->data_size ? size - hdr->data_size : 0;
+	pos = (offs + skip) & mask;
+	chunk = min_t(size_t, size - skip, hdr->data_size - pos);
+
+	aesd_mmap_write_begin(hdr);
+	if (cmd) {
+		memcpy(devp->mmap_data + pos, cmd + skip, chunk);
+		memcpy(devp->mmap_data, cmd + skip + chunk, size - skip - chunk);
+	}
+	hdr->entries[hdr->next_cmd % AESD_MMAP_MAX_ENTRIES].offs = offs;
+	hdr->entries[hdr->next_cmd % AESD_MMAP_MAX_ENTRIES].size = size;
+	hdr->next_cmd++;
+	hdr->end_offs = offs + size;
+	aesd_mmap_trim(hdr, start_offs);
+	aesd_mmap_write_end(hdr);
+}
+
+/*
+ * Samples the running offsets of the oldest stored byte and one past the newest one
+ */
+static void aesd_sample_offs(struct aesd_dev *devp, size_t *start_offs_rtn, size_t *end_offs_rtn)
+{
+	struct aesd_circular_buffer *buffer;
+	unsigned int seq;
+	int srcu_idx;
+
+	srcu_idx = srcu_read_lock(&devp->srcu);
+	do {
+		seq = read_seqcount_begin(&devp->seq);
+		buffer = srcu_dereference(devp->buf, &devp->srcu);
+		*end_offs_rtn = buffer->end_offs;
+		*start_offs_rtn = buffer->end_offs - buffer->total_size;
+	} while (read_seqcount_retry(&devp->seq, seq));
+	srcu_read_unlock(&devp->srcu, srcu_idx);
+}
+
+/*
+ * @return true when @devp holds data past the running offset @offs
+ */
+static bool aesd_data_after(struct aesd_dev *devp, size_t offs)
+{
+	size_t start_offs, end_offs;
+
+	aesd_sample_offs(devp, &start_offs, &end_offs);
+	return end_offs > offs;
+}
+
+/*
+ * Records the running offset matching f_pos @f_pos, used by poll and tail reads to tell
+ * new data from old even after eviction shifted the file positions
+ */
+static void aesd_set_pos_offs(struct aesd_file *file, loff_t f_pos)
+{
+	size_t start_offs, end_offs;
+
+	aesd_sample_offs(file->dev, &start_offs, &end_offs);
+	WRITE_ONCE(file->pos_offs, start_offs + f_pos);
+}
+
+/*
+ * In tail mode, waits until data past the position of @file is written, then moves
+ * @f_pos to it, skipping anything evicted meanwhile.  Caller holds cursor_lock, which is
+ * dropped while sleeping so seeks and other readers of @file are not held up.  The
+ * position may have moved by the time it is retaken, so it is checked again.
+ */
+static int aesd_tail_wait(struct aesd_file *file, bool nonblock, loff_t *f_pos)
+{
+	struct aesd_dev *devp = file->dev;
+	size_t start_offs, end_offs;
+	int rc;
+
+	while (file->tail && !aesd_data_after(devp, file->pos_offs)) {
+		if (nonblock) {
+			return -EAGAIN;
+		}
+		mutex_unlock(&file->cursor_lock);
+		rc = wait_event_interruptible(devp->wait, aesd_data_after(devp, READ_ONCE(file->pos_offs)));
+		// Others only hold cursor_lock briefly, so this does not need to be interruptible
+		mutex_lock(&file->cursor_lock);
+		if (rc) {
+			return -ERESTARTSYS;
+		}
+	}
+	if (!file->tail) {
+		// Tail mode was switched off while sleeping, read from f_pos as usual
+		return 0;
+	}
+	aesd_sample_offs(devp, &start_offs, &end_offs);
+	*f_pos = file->pos_offs > start_offs ? file->pos_offs - start_offs : 0;
+	return 0;
+}
+
+/*
+ * The cached read cursor of @file is usable for a read at @f_pos when it was left at
+ * exactly that position and no entry has been evicted since.  Caller holds cursor_lock.
+ */
+static bool aesd_cursor_valid(struct aesd_file *file, struct aesd_circular_buffer *buffer, loff_t f_pos)
+{
+	return file->cursor_valid && file->cursor_fpos == f_pos &&
+		file->cursor_generation == buffer->generation;
+}
+
+/*
+ * Points the cursor of @file at byte @offset of entry @index of a buffer at @generation.
+ * Caller holds cursor_lock.
+ */
+static void aesd_cursor_set(struct aesd_file *file, loff_t f_pos, unsigned int index,
+		size_t offset, unsigned long generation)
+{
+	file->cursor_valid = true;
+	file->cursor_fpos = f_pos;
+	file->cursor_index = index;
+	file->cursor_offset = offset;
+	file->cursor_generation = generation;
+}
+
+/*
+ * Samples the entry a read at @f_pos copies from without taking the device lock,
+ * continuing from the cursor of @file when it is still valid.  Retries until no writer
+ * raced with the sample.  Caller holds cursor_lock and the srcu read lock, which keeps
+ * the sampled buffptr alive even if the entry is evicted meanwhile.  @start_offs_rtn is
+ * set to the running offset f_pos is relative to.
+ * @return false at the end of the data
+ */
+static bool aesd_read_sample(struct aesd_dev *devp, struct aesd_file *file, loff_t f_pos,
+		struct aesd_buffer_entry *entry_rtn, unsigned int *index_rtn, size_t *offset_rtn,
+		unsigned long *generation_rtn, size_t *start_offs_rtn)
+{
+	struct aesd_circular_buffer *buffer;
+	struct aesd_buffer_entry *buf_entry;
+	unsigned int seq, index;
+	size_t offset;
+	int found;
+
+	do {
+		seq = read_seqcount_begin(&devp->seq);
+		buffer = srcu_dereference(devp->buf, &devp->srcu);
+		buf_entry = NULL;
+		// Sequential reads continue from the cached cursor, anything else needs a lookup
+		if (aesd_cursor_valid(file, buffer, f_pos)) {
+			index = file->cursor_index;
+			offset = file->cursor_offset;
+		} else {
+			found = aesd_circular_buffer_find_index_for_fpos(buffer, f_pos, &offset);
+			index = found < 0 ? aesd_circular_buffer_count(buffer) : found;
+		}
+		buf_entry = aesd_circular_buffer_get_entry(buffer, index, NULL);
+		if (buf_entry && offset >= buf_entry->size) {
+			index++;
+			offset = 0;
+			buf_entry = aesd_circular_buffer_get_entry(buffer, index, NULL);
+		}
+		if (buf_entry) {
+			*entry_rtn = *buf_entry;
+		}
+		*generation_rtn = buffer->generation;
+		*start_offs_rtn = buffer->end_offs - buffer->total_size;
+	} while (read_seqcount_retry(&devp->seq, seq));
+
+	*index_rtn = index;
+	*offset_rtn = offset;
+	return buf_entry != NULL;
+}
+
+/*
+ * aesd_read_iter() for a device storing commands in a byte ring.  Data is contiguous across
+ * entries, so a read needs at most two copies.  Ring bytes are reused as soon as their
+ * command is evicted: a copy is only kept if write_offs shows no writer reached the copied
+ * bytes meanwhile, otherwise it is redone at the position f_pos now refers to.  Caller
+ * holds cursor_lock and the srcu read lock.
+ */
+static ssize_t aesd_read_ring(struct aesd_dev *devp, struct aesd_file *file, struct iov_iter *to,
+		loff_t *f_pos)
+{
+	struct aesd_circular_buffer *buffer;
+	size_t copied = 0, start_offs, end_offs, offs, chunk, done;
+	unsigned int seq;
+
+	while (iov_iter_count(to)) {
+		do {
+			seq = read_seqcount_begin(&devp->seq);
+			buffer = srcu_dereference(devp->buf, &devp->srcu);
+			end_offs = buffer->end_offs;
+			start_offs = end_offs - buffer->total_size;
+		} while (read_seqcount_retry(&devp->seq, seq));
+		if (*f_pos >= end_offs - start_offs) {
+			break;
+		}
+
+		offs = start_offs + *f_pos;
+		chunk = min3(iov_iter_count(to), end_offs - offs,
+				buffer->ring_size - (offs & (buffer->ring_size - 1)));
+		done = copy_to_iter(aesd_circular_buffer_ring_ptr(buffer, offs), chunk, to);
+		smp_rmb();
+		// A resize may have replaced buffer, the current one tracks write_offs
+		buffer = srcu_dereference(devp->buf, &devp->srcu);
+		if (READ_ONCE(buffer->write_offs) > offs + buffer->ring_size) {
+			iov_iter_revert(to, done);
+			continue;
+		}
+
+		copied += done;
+		*f_pos += done;
+		WRITE_ONCE(file->pos_offs, offs + done);
+		if (done < chunk) {
+			// Report what was copied before the fault, if anything
+			return copied ? copied : -EFAULT;
+		}
+	}
+	return copied;
+}
+
+ssize_t aesd_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct file *filp = iocb->ki_filp;
+    loff_t *f_pos = &iocb->ki_pos;
+    loff_t start_pos = *f_pos;
+    size_t requested = iov_iter_count(to);
+    unsigned int cursor_index;
+    ssize_t retval = 0;
+    PDEBUG("read %zu bytes with offset %lld",iov_iter_count(to),*f_pos);
+    /**
+     * TODO: handle read
+     */
+	     
+	// validate inputs
+	if(filp==NULL) {
+		retval = -EINVAL;
+		goto exit;
+	}
+	
+	struct aesd_file *file = filp->private_data;
+	struct aesd_dev *devp;
+	
+	if(!file) {               
+		retval = -EPERM;
+		goto exit;
+	}
+	devp = file->dev;
+	
+	// Only other users of this open file serialize with us, never other readers or writers
+	if (mutex_lock_interruptible(&file->cursor_lock)) 
+    {
+        retval = -ERESTARTSYS;
+        goto exit;
+    }
+	if (file->tail) {
+		retval = aesd_tail_wait(file, (filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT),
+				f_pos);
+		if (retval) {
+			mutex_unlock(&file->cursor_lock);
+			goto exit;
+		}
+	}
+	int srcu_idx = srcu_read_lock(&devp->srcu);
+	if (srcu_dereference(devp->buf, &devp->srcu)->ring) {
+		retval = aesd_read_ring(devp, file, to, f_pos);
+		goto unlock;
+	}
+	
+	// Fill as much of the request as possible, walking consecutive entries
+	struct aesd_buffer_entry buf_entry;
+	unsigned int index;
+	unsigned long generation;
+	size_t offset, bytes_to_copy, done, copied = 0, start_offs;
+	while (iov_iter_count(to)) {
+		if (!aesd_read_sample(devp, file, *f_pos, &buf_entry, &index, &offset, &generation,
+					&start_offs)) {
+			break;
+		}
+		
+		bytes_to_copy = min(iov_iter_count(to), buf_entry.size - offset);
+		done = copy_to_iter(buf_entry.buffptr + offset, bytes_to_copy, to);
+		
+		copied += done;
+		*f_pos += done;
+		aesd_cursor_set(file, *f_pos, index, offset + done, generation);
+		WRITE_ONCE(file->pos_offs, buf_entry.offs + offset + done);
+		if (done < bytes_to_copy) 
+		{
+			// Report what was copied before the fault, if anything
+			if (!copied) {
+				retval = -EFAULT;
+				goto unlock;
+			}
+			break;
+		}
+	}
+	retval = copied;
+	
+	unlock:
+		srcu_read_unlock(&devp->srcu, srcu_idx);
+		// The trace runs unlocked, by then another read or seek may have moved the cursor
+		cursor_index = file->cursor_index;
+		mutex_unlock(&file->cursor_lock);
+		this_cpu_inc(devp->counters->reads);
+		if (retval > 0) {
+			this_cpu_add(devp->counters->read_bytes, retval);
+		}
+		trace_aesd_read(devp, start_pos, requested, retval, cursor_index);
+	exit:	
+    	return retval;
+}
+
+/*
+ * Grows the pending command buffer of @file to hold at least @size bytes.  Capacity at
+ * least doubles each time, so a command assembled from many small writes is copied
+ * O(1) times per byte.  Caller holds the pending lock of @file.
+ */
+static int aesd_reserve_pending(struct aesd_file *file, size_t size)
+{
+    size_t alloc;
+    struct aesd_cmd *grown;
+
+    if (size <= file->entry_alloc) {
+        return 0;
+    }
+    alloc = max3(size, file->entry_alloc * 2, (size_t)AESD_PENDING_MIN_ALLOC);
+    grown = krealloc(file->entry.buffptr ? aesd_cmd_of(file->entry.buffptr) : NULL,
+            sizeof(struct aesd_cmd) + alloc, GFP_KERNEL);
+    if (!grown) {
+        return -ENOMEM;
+    }
+    grown->cache = AESD_CMD_KMALLOC;
+    file->entry.buffptr = grown->data;
+    file->entry_alloc = alloc;
+    return 0;
+}
+
+/*
+ * Allocates a command buffer for @size bytes, taken from the cache of its size class when
+ * there is one
+ */
+static struct aesd_cmd *aesd_cmd_alloc(size_t size)
+{
+    unsigned char class = aesd_cmd_class(size);
+    struct aesd_cmd *cmd;
+
+    if (class == AESD_CMD_KMALLOC) {
+        cmd = kmalloc(sizeof(struct aesd_cmd) + size, GFP_KERNEL);
+    } else {
+        cmd = kmem_cache_alloc(aesd_cmd_classes[class].cache, GFP_KERNEL);
+    }
+    if (cmd) {
+        cmd->cache = class;
+    }
+    return cmd;
+}
+
+/*
+ * Copies @size bytes at @data into a new command buffer
+ * @return the buffptr of the command or NULL
+ */
+static const char *aesd_cmd_dup(const char *data, size_t size)
+{
+    struct aesd_cmd *cmd = aesd_cmd_alloc(size);
+
+    if (!cmd) {
+        return NULL;
+    }
+    memcpy(cmd->data, data, size);
+    return cmd->data;
+}
+
+/*
+ * Adds the complete command @cmd of @size bytes, allocated as a struct aesd_cmd, to the
+ * circular buffer of @devp, which takes ownership of it.  A buffer with a byte ring copies
+ * @cmd instead, the caller keeps it.  Caller holds the device lock.
+ */
+static void aesd_add_command(struct aesd_dev *devp, const char *cmd, size_t size)
+{
+    struct aesd_buffer_entry entry = {
+        .buffptr = cmd,
+        .size = size,
+    };
+    const char *bufp;
+    unsigned long max_bytes = READ_ONCE(aesd_max_bytes);
+    struct aesd_circular_buffer *buffer = aesd_locked_buf(devp);
+    unsigned int count = aesd_circular_buffer_count(buffer), evicted;
+    size_t start_offs = buffer->end_offs - buffer->total_size;
+
+    write_seqcount_begin(&devp->seq);
+    // Evict down to the byte budget, the newest command is always kept
+    while (max_bytes && aesd_circular_buffer_count(buffer) &&
+            aesd_circular_buffer_size(buffer) + size > max_bytes) {
+        aesd_cmd_release(devp, aesd_circular_buffer_remove_entry(buffer));
+    }
+    bufp = aesd_circular_buffer_add_entry(buffer, &entry);
+    write_seqcount_end(&devp->seq);
+    evicted = count + 1 - aesd_circular_buffer_count(buffer);
+    if (evicted) {
+        this_cpu_add(devp->counters->evictions, evicted);
+        trace_aesd_evict(devp, evicted, buffer->end_offs - buffer->total_size - start_offs,
+                buffer->end_offs - buffer->total_size);
+    }
+    this_cpu_inc(devp->counters->write_cmds);
+    this_cpu_add(devp->counters->write_bytes, size);
+    aesd_mmap_commit(devp, buffer->ring ? NULL : cmd, size, buffer->end_offs - size,
+            buffer->end_offs - buffer->total_size);
+    // Free memory associated with overwritten entry if circular buffer is full
+    aesd_cmd_release(devp, bufp);
+    wake_up_interruptible_poll(&devp->wait, EPOLLIN | EPOLLRDNORM);
+}
+
+/*
+ * Adds the complete command @cmd of @size bytes to the circular buffer of @devp, see
+ * aesd_add_command().  This is the only step of a write that takes the device lock.
+ */
+static void aesd_publish(struct aesd_dev *devp, const char *cmd, size_t size)
+{
+    struct aesd_circular_buffer *buffer;
+    u64 start, wait_ns = 0;
+
+    // Only contended acquisitions are timed, the common case pays no clock reads
+    if (!mutex_trylock(&devp->lock)) {
+        start = ktime_get_ns();
+        mutex_lock(&devp->lock);
+        wait_ns = ktime_get_ns() - start;
+        this_cpu_add(devp->counters->lock_wait_ns, wait_ns);
+    }
+    aesd_add_command(devp, cmd, size);
+    buffer = aesd_locked_buf(devp);
+    trace_aesd_write_commit(devp, size, buffer->end_offs - size,
+            aesd_circular_buffer_count(buffer), wait_ns);
+    mutex_unlock(&devp->lock);
+}
+
+/*
+ * @return true if a command of @size bytes can never be stored by @devp, because it does
+ * not fit in the byte ring
+ */
+static bool aesd_cmd_too_big(struct aesd_dev *devp, size_t size)
+{
+    return devp->ring_size && size > devp->ring_size;
+}
+
+/*
+ * Moves the completed pending command of @file into the circular buffer.  Commands of a
+ * size class are copied into their cache and the pending buffer is kept for the next
+ * command, larger ones are handed over with slack left by geometric growth trimmed once
+ * here.  Caller holds the pending lock of @file.
+ */
+static void aesd_commit_pending(struct aesd_file *file)
+{
+    struct aesd_dev *devp = file->dev;
+    struct aesd_cmd *trimmed;
+
+    // The ring keeps its own copy, the pending buffer is reused for the next command
+    if (devp->ring_size) {
+        aesd_publish(devp, file->entry.buffptr, file->entry.size);
+        file->entry.size = 0;
+        return;
+    }
+
+    if (aesd_cmd_class(file->entry.size) != AESD_CMD_KMALLOC) {
+        const char *cmd = aesd_cmd_dup(file->entry.buffptr, file->entry.size);
+        if (cmd) {
+            aesd_publish(devp, cmd, file->entry.size);
+            file->entry.size = 0;
+            return;
+        }
+    }
+
+    if (file->entry_alloc > 2 * file->entry.size) {
+        trimmed = krealloc(aesd_cmd_of(file->entry.buffptr),
+                sizeof(struct aesd_cmd) + file->entry.size, GFP_KERNEL);
+        if (trimmed) {
+            file->entry.buffptr = trimmed->data;
+        }
+    }
+
+    aesd_publish(devp, file->entry.buffptr, file->entry.size);
+
+    file->entry.size = 0;
+    file->entry.buffptr = NULL;
+    file->entry_alloc = 0;
+}
+
+ssize_t aesd_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct file *filp = iocb->ki_filp;
+    size_t count = iov_iter_count(from);
+    ssize_t retval = -ENOMEM;
+    PDEBUG("write %zu bytes with offset %lld", count, iocb->ki_pos);
+
+    // Validate inputs
+    if (!filp) {
+        retval = -EINVAL;
+        goto exit;
+    }
+
+    // Get a reference to the device structure
+    struct aesd_file *file = filp->private_data;
+    if (!file) {
+        retval = -EPERM;
+        goto exit;
+    }
+    struct aesd_dev *devp = file->dev;
+
+    // Partial commands are staged per open file, only threads sharing it serialize here
+    if (mutex_lock_interruptible(&file->pending_lock)) {
+        retval = -ERESTARTSYS;
+        goto exit;
+    }
+
+    trace_aesd_write_entry(devp, count, file->entry.size);
+
+    // Make room for the whole write at the end of the pending command
+    if (aesd_reserve_pending(file, file->entry.size + count)) {
+        retval = -ENOMEM;
+        goto unlock_mutex;
+    }
+
+    // Copy data from user space straight into its final location
+    char *pending = (char *)file->entry.buffptr + file->entry.size;
+    if (copy_from_iter(pending, count, from) != count) {
+        retval = -EFAULT;
+        goto unlock_mutex;
+    }
+
+    // Split off every complete command, the text after the last '\n' stays pending
+    char *data = (char *)file->entry.buffptr;
+    size_t pending_size = file->entry.size;
+    size_t end = pending_size + count;
+    size_t start = 0, keep_end = end;
+    char *end_of_text;
+    int err = -ENOMEM;
+    while (start < end && (end_of_text = memchr(data + max(start, pending_size), '\n',
+                    end - max(start, pending_size)))) {
+        size_t cmd_end = end_of_text - data + 1;
+        if (aesd_cmd_too_big(devp, cmd_end - start)) {
+            // Keep what was already committed, report the rest as not written
+            keep_end = max(start, pending_size);
+            err = -EFBIG;
+            break;
+        }
+        if (start == 0 && cmd_end == end) {
+            // The common single command write, hand the pending buffer over as is
+            file->entry.size = end;
+            aesd_commit_pending(file);
+            retval = count;
+            goto unlock_mutex;
+        }
+
+        if (devp->ring_size) {
+            aesd_publish(devp, data + start, cmd_end - start);
+            start = cmd_end;
+            continue;
+        }
+        const char *cmd = aesd_cmd_dup(data + start, cmd_end - start);
+        if (!cmd) {
+            // Keep what was already committed, report the rest as not written
+            keep_end = max(start, pending_size);
+            break;
+        }
+        aesd_publish(devp, cmd, cmd_end - start);
+        start = cmd_end;
+    }
+    if (keep_end == end && aesd_cmd_too_big(devp, end - start)) {
+        // The partial command left pending could never be committed
+        keep_end = max(start, pending_size);
+        err = -EFBIG;
+    }
+
+    if (start) {
+        memmove(data, data + start, keep_end - start);
+    }
+    file->entry.size = keep_end - start;
+    if (file->entry.size) {
+        this_cpu_inc(devp->counters->fragments);
+    }
+    retval = keep_end - pending_size;
+    if (!retval && count) {
+        retval = err;
+    }
+
+unlock_mutex:
+    mutex_unlock(&file->pending_lock);
+exit:
+    return retval;
+}
+
+loff_t aesd_llseek(struct file *filp, loff_t off, int operation) {
+	
+	struct aesd_file *file = filp->private_data;
+	struct aesd_dev *devp = file->dev;
+	loff_t f_pos;
+	unsigned int seq;
+	int srcu_idx;
+	
+	switch(operation) {
+		case SEEK_SET: 
+			f_pos = off;
+			break;
+		case SEEK_CUR:
+			f_pos = filp->f_pos + off;
+			break;
+		case SEEK_END:
+			srcu_idx = srcu_read_lock(&devp->srcu);
+			do {
+				seq = read_seqcount_begin(&devp->seq);
+				f_pos = aesd_circular_buffer_size(srcu_dereference(devp->buf, &devp->srcu)) + off;
+			} while (read_seqcount_retry(&devp->seq, seq));
+			srcu_read_unlock(&devp->srcu, srcu_idx);
+			break;
+		default:
+			return -EINVAL;
+	}
+	if (f_pos < 0) {
+		return -EINVAL;
+	}
+	filp->f_pos = f_pos;
+	aesd_set_pos_offs(file, f_pos);
+	trace_aesd_llseek(devp, off, operation, f_pos);
+	return f_pos;
+	
+}
+
+/*
+ * Readable while data past the position of the file remains, which tail readers use to
+ * sleep in poll/epoll until the next command is written.  Writes never wait for space.
+ */
+static __poll_t aesd_poll(struct file *filp, poll_table *wait)
+{
+	struct aesd_file *file = filp->private_data;
+	struct aesd_dev *devp = file->dev;
+	__poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+	poll_wait(filp, &devp->wait, wait);
+	if (aesd_data_after(devp, READ_ONCE(file->pos_offs))) {
+		mask |= EPOLLIN | EPOLLRDNORM;
+	}
+	return mask;
+}
+
+/*
+ * Replaces the circular buffer of the device of @file with one retaining @capacity
+ * commands, keeping the newest ones.  Readers still using the old buffer are waited for
+ * before it is freed.
+ */
+static int aesd_set_capacity(struct aesd_file *file, unsigned int capacity)
+{
+	struct aesd_dev *devp = file->dev;
+	struct aesd_circular_buffer *buffer, *resized;
+	int result;
+
+	resized = kmalloc(sizeof(struct aesd_circular_buffer), GFP_KERNEL);
+	if (!resized) {
+		return -ENOMEM;
+	}
+
+	if (mutex_lock_interruptible(&devp->lock)) {
+		kfree(resized);
+		return -ERESTARTSYS;
+	}
+	if(atomic_read(&devp->open_count) > 1 || READ_ONCE(file->entry.size)) {
+		mutex_unlock(&devp->lock);
+		kfree(resized);
+		return -EBUSY;
+	}
+
+	buffer = aesd_locked_buf(devp);
+	// The copy shares commands and any byte ring and keeps running offsets continuous.  It
+	// is made before anything is dropped, so a failure leaves the device as it was.
+	result = aesd_circular_buffer_init_copy_newest(resized, buffer, capacity);
+	if (result) {
+		mutex_unlock(&devp->lock);
+		kfree(resized);
+		return result;
+	}
+
+	write_seqcount_begin(&devp->seq);
+	// The oldest commands did not make it into the copy
+	while(aesd_circular_buffer_count(buffer) > capacity) {
+		aesd_cmd_release(devp, aesd_circular_buffer_remove_entry(buffer));
+	}
+	rcu_assign_pointer(devp->buf, resized);
+	if (devp->mmap_hdr) {
+		aesd_mmap_write_begin(devp->mmap_hdr);
+		aesd_mmap_trim(devp->mmap_hdr, resized->end_offs - resized->total_size);
+		aesd_mmap_write_end(devp->mmap_hdr);
+	}
+	write_seqcount_end(&devp->seq);
+	mutex_unlock(&devp->lock);
+
+	synchronize_srcu(&devp->srcu);
+	aesd_circular_buffer_free(buffer);
+	kfree(buffer);
+	return 0;
+}
+
+/*
+ * Sums the per-CPU counters of @devp into @sum.  Counters keep moving meanwhile, so the
+ * result is only a consistent snapshot while the device is idle.
+ */
+static void aesd_counters_sum(struct aesd_dev *devp, struct aesd_counters *sum)
+{
+	const struct aesd_counters *c;
+	int cpu;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		c = per_cpu_ptr(devp->counters, cpu);
+		sum->write_bytes += c->write_bytes;
+		sum->write_cmds += c->write_cmds;
+		sum->reads += c->reads;
+		sum->read_bytes += c->read_bytes;
+		sum->evictions += c->evictions;
+		sum->fragments += c->fragments;
+		sum->lock_wait_ns += c->lock_wait_ns;
+	}
+}
+
+static long aesd_get_stats(struct aesd_file *file, struct aesd_stats __user *arg)
+{
+	struct aesd_dev *devp = file->dev;
+	struct aesd_circular_buffer *buffer;
+	struct aesd_stats stats;
+	struct aesd_counters sum;
+
+	memset(&stats, 0, sizeof(stats));
+	aesd_counters_sum(devp, &sum);
+	if (mutex_lock_interruptible(&devp->lock)) {
+		return -ERESTARTSYS;
+	}
+	buffer = aesd_locked_buf(devp);
+	stats.bytes = aesd_circular_buffer_size(buffer);
+	stats.entries = aesd_circular_buffer_count(buffer);
+	stats.evictions = sum.evictions;
+	stats.capacity = buffer->capacity;
+	mutex_unlock(&devp->lock);
+	stats.max_bytes = READ_ONCE(aesd_max_bytes);
+	stats.pending_bytes = READ_ONCE(file->entry.size);
+
+	if (copy_to_user(arg, &stats, sizeof(stats))) {
+		return -EFAULT;
+	}
+	return 0;
+}
+
+/*
+ * Samples the commands AESDCHAR_IOCREADENTRIES returns for @req into @descs, with
+ * data_offset still relative to the first payload, and the matching entries into
+ * @entries.  Retries until no writer raced with the sample.  Caller holds the srcu read
+ * lock.
+ * @return the number of commands sampled, or -ENOSPC when the first one does not fit
+ */
+static int aesd_sample_entries(struct aesd_dev *devp, const struct aesd_read_entries *req,
+		unsigned int max_count, struct aesd_entry_desc *descs, struct aesd_buffer_entry *entries)
+{
+	struct aesd_circular_buffer *buffer;
+	struct aesd_buffer_entry *buf_entry;
+	unsigned int seq, n;
+	size_t fpos;
+	uint64_t used;
+
+	do {
+		seq = read_seqcount_begin(&devp->seq);
+		buffer = srcu_dereference(devp->buf, &devp->srcu);
+		used = 0;
+		for (n = 0; n < max_count; n++) {
+			buf_entry = aesd_circular_buffer_get_entry(buffer, req->start + n, &fpos);
+			if (!buf_entry) {
+				break;
+			}
+			// Every header added moves the payloads further into the buffer
+			if ((n + 1) * sizeof(struct aesd_entry_desc) + used + buf_entry->size > req->buf_size) {
+				break;
+			}
+			descs[n].index = req->start + n;
+			descs[n].reserved = 0;
+			descs[n].fpos = fpos;
+			descs[n].size = buf_entry->size;
+			descs[n].data_offset = used;
+			entries[n] = *buf_entry;
+			used += buf_entry->size;
+		}
+		buf_entry = aesd_circular_buffer_get_entry(buffer, req->start, NULL);
+	} while (read_seqcount_retry(&devp->seq, seq));
+
+	// Only a first command that did not fit is an error, max_count 0 simply returns nothing
+	return n == 0 && max_count && buf_entry ? -ENOSPC : n;
+}
+
+/*
+ * Copies the payload of @entry to @dst.  Entries of a byte ring are copied in up to two
+ * pieces and checked against write_offs, see aesd_read_ring().
+ * @return 0, -EFAULT or -EAGAIN when the ring bytes were overwritten while copying
+ */
+static int aesd_copy_entry(struct aesd_dev *devp, const struct aesd_buffer_entry *entry,
+		char __user *dst)
+{
+	struct aesd_circular_buffer *buffer = srcu_dereference(devp->buf, &devp->srcu);
+	size_t chunk;
+
+	if (entry->buffptr) {
+		return copy_to_user(dst, entry->buffptr, entry->size) ? -EFAULT : 0;
+	}
+	chunk = min(entry->size, buffer->ring_size - (entry->offs & (buffer->ring_size - 1)));
+	if (copy_to_user(dst, aesd_circular_buffer_ring_ptr(buffer, entry->offs), chunk) ||
+			copy_to_user(dst + chunk, buffer->ring, entry->size - chunk)) {
+		return -EFAULT;
+	}
+	smp_rmb();
+	buffer = srcu_dereference(devp->buf, &devp->srcu);
+	return READ_ONCE(buffer->write_offs) > entry->offs + buffer->ring_size ? -EAGAIN : 0;
+}
+
+static long aesd_read_entries(struct aesd_dev *devp, struct aesd_read_entries __user *arg)
+{
+	struct aesd_read_entries req;
+	struct aesd_entry_desc *descs;
+	struct aesd_buffer_entry *entries;
+	char __user *buf;
+	unsigned int max_count;
+	int n, i, srcu_idx;
+	long result = 0;
+
+	if (copy_from_user(&req, arg, sizeof(req))) {
+		return -EFAULT;
+	}
+	buf = (char __user *)(uintptr_t)req.buf;
+	max_count = min_t(unsigned int, req.max_count, AESD_READ_ENTRIES_MAX);
+	descs = kmalloc_array(max(max_count, 1U), sizeof(*descs), GFP_KERNEL);
+	entries = kmalloc_array(max(max_count, 1U), sizeof(*entries), GFP_KERNEL);
+	if (!descs || !entries) {
+		result = -ENOMEM;
+		goto out;
+	}
+
+	srcu_idx = srcu_read_lock(&devp->srcu);
+	// Evicted commands stay readable until srcu_read_unlock, only a reused ring needs a retry
+	do {
+		n = aesd_sample_entries(devp, &req, max_count, descs, entries);
+		if (n < 0) {
+			result = n;
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			// Payloads follow the n headers
+			descs[i].data_offset += n * sizeof(*descs);
+			result = aesd_copy_entry(devp, &entries[i], buf + descs[i].data_offset);
+			if (result) {
+				break;
+			}
+		}
+	} while (result == -EAGAIN);
+	srcu_read_unlock(&devp->srcu, srcu_idx);
+	if (result) {
+		goto out;
+	}
+
+	req.count = n;
+	req.bytes = n ? descs[n - 1].data_offset + descs[n - 1].size : 0;
+	if (copy_to_user(buf, descs, n * sizeof(*descs)) || copy_to_user(arg, &req, sizeof(req))) {
+		result = -EFAULT;
+	}
+out:
+	kfree(descs);
+	kfree(entries);
+	return result;
+}
+
+/*
+ * A command sampled by AESDCHAR_IOCSEARCH
+ */
+struct aesd_search_entry {
+	struct aesd_buffer_entry entry;
+	size_t fpos;
+};
+
+/*
+ * Samples up to AESD_SEARCH_ENTRIES_MAX commands from index @start into @sampled in one
+ * read section, so they are a consistent snapshot.  Caller holds the srcu read lock,
+ * which keeps their buffptr alive.  @more_rtn is set when commands past them are stored.
+ * @return the number of commands sampled
+ */
+static unsigned int aesd_search_sample(struct aesd_dev *devp, unsigned int start,
+		struct aesd_search_entry *sampled, bool *more_rtn)
+{
+	struct aesd_circular_buffer *buffer;
+	struct aesd_buffer_entry *buf_entry;
+	unsigned int seq, n;
+
+	do {
+		seq = read_seqcount_begin(&devp->seq);
+		buffer = srcu_dereference(devp->buf, &devp->srcu);
+		for (n = 0; n < AESD_SEARCH_ENTRIES_MAX; n++) {
+			buf_entry = aesd_circular_buffer_get_entry(buffer, start + n, &sampled[n].fpos);
+			if (!buf_entry) {
+				break;
+			}
+			sampled[n].entry = *buf_entry;
+		}
+		*more_rtn = n == AESD_SEARCH_ENTRIES_MAX &&
+			aesd_circular_buffer_get_entry(buffer, start + n, NULL);
+	} while (read_seqcount_retry(&devp->seq, seq));
+
+	return n;
+}
+
+/*
+ * @return true if the @len bytes at @pos of the data split in @seg0 and @seg1 equal @pat
+ */
+static bool aesd_match_at(const char *seg0, size_t len0, const char *seg1, size_t pos,
+		const char *pat, size_t len)
+{
+	size_t head;
+
+	if (pos >= len0) {
+		return !memcmp(seg1 + pos - len0, pat, len);
+	}
+	head = min(len, len0 - pos);
+	return !memcmp(seg0 + pos, pat, head) && (head == len || !memcmp(seg1, pat + head, len - head));
+}
 
-int aesd_open(struct inode *inode, struct file *filp)
+/*
+ * Finds the first occurrence of @pat at or after @from in the data made of @len0 bytes at
+ * @seg0 followed by @len1 bytes at @seg1, the two pieces of a command wrapping around a
+ * byte ring.  Candidates are located with memchr() on the first pattern byte and then
+ * compared, the kernel has no memmem().
+ * @return the offset of the match or SIZE_MAX
+ */
+static size_t aesd_search_data(const char *seg0, size_t len0, const char *seg1, size_t len1,
+		const char *pat, size_t pat_len, size_t from)
 {
-    PDEBUG("open");
-    /**
-     * TODO: handle open
-     */
-    filp->private_data = container_of(inode->i_cdev, struct aesd_dev, cdev);
-    return 0;
+	size_t last, end, pos;
+	const char *p;
+
+	if (pat_len > len0 + len1) {
+		return SIZE_MAX;
+	}
+	// Last offset a match can start at
+	last = len0 + len1 - pat_len;
+	while (from <= last) {
+		if (from < len0) {
+			end = min(len0, last + 1);
+			p = memchr(seg0 + from, pat[0], end - from);
+			if (!p) {
+				// Nothing in the first piece, go on with the second one
+				from = end;
+				continue;
+			}
+			pos = p - seg0;
+		} else {
+			p = memchr(seg1 + from - len0, pat[0], last + 1 - from);
+			if (!p) {
+				break;
+			}
+			pos = len0 + (p - seg1);
+		}
+		if (aesd_match_at(seg0, len0, seg1, pos, pat, pat_len)) {
+			return pos;
+		}
+		from = pos + 1;
+	}
+	return SIZE_MAX;
 }
 
-int aesd_release(struct inode *inode, struct file *filp)
+/*
+ * Appends the matches of @pat in sampled command @index, from byte @from, to @matches until
+ * @max_matches are stored.  Caller holds the srcu read lock.
+ * @return 0 or -EAGAIN when the bytes of a byte ring command were overwritten while searched
+ */
+static int aesd_search_entry(struct aesd_dev *devp, const struct aesd_search_entry *sampled,
+		unsigned int index, size_t from, const char *pat, size_t pat_len,
+		struct aesd_search_match *matches, unsigned int *count, unsigned int max_matches)
 {
-    PDEBUG("release");
-    /**
-     * TODO: handle release
-     */
-    filp->private_data = NULL;
-    return 0;
+	const struct aesd_buffer_entry *entry = &sampled->entry;
+	struct aesd_circular_buffer *buffer = srcu_dereference(devp->buf, &devp->srcu);
+	const char *seg0 = entry->buffptr, *seg1 = NULL;
+	size_t len0 = entry->size, len1 = 0, pos;
+
+	if (!entry->buffptr) {
+		len0 = min(entry->size, buffer->ring_size - (entry->offs & (buffer->ring_size - 1)));
+		seg0 = aesd_circular_buffer_ring_ptr(buffer, entry->offs);
+		seg1 = buffer->ring;
+		len1 = entry->size - len0;
+	}
+	while (*count < max_matches &&
+			(pos = aesd_search_data(seg0, len0, seg1, len1, pat, pat_len, from)) != SIZE_MAX) {
+		matches[*count].index = index;
+		matches[*count].offset = pos;
+		matches[*count].fpos = sampled->fpos + pos;
+		(*count)++;
+		from = pos + 1;
+	}
+	if (entry->buffptr) {
+		return 0;
+	}
+	// Same check as aesd_copy_entry(), a match found in reused bytes may be bogus
+	smp_rmb();
+	buffer = srcu_dereference(devp->buf, &devp->srcu);
+	return READ_ONCE(buffer->write_offs) > entry->offs + buffer->ring_size ? -EAGAIN : 0;
 }
 
-ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
-                loff_t *f_pos)
+static long aesd_search(struct aesd_dev *devp, struct aesd_search __user *arg)
 {
-    ssize_t retval = 0;
-    PDEBUG("read %zu bytes with offset %lld",count,*f_pos);
-    /**
-     * TODO: handle read
-     */
-	     
-	// validate inputs
-	if(filp==NULL || buf==NULL) {
-		retval = -EINVAL;
-		goto exit;
+	struct aesd_search req;
+	struct aesd_search_entry *sampled = NULL;
+	struct aesd_search_match *matches = NULL;
+	char *pat = NULL;
+	unsigned int max_matches, count, n, i;
+	int srcu_idx;
+	bool more;
+	long result;
+
+	if (copy_from_user(&req, arg, sizeof(req))) {
+		return -EFAULT;
 	}
-	
-	struct aesd_dev *devp;
-	devp = filp->private_data;
-	
-	if(!devp) {               
-		retval = -EPERM;
-		goto exit;
+	if (req.pattern_len == 0 || req.pattern_len > AESD_SEARCH_PATTERN_MAX || req.max_matches == 0) {
+		return -EINVAL;
+	}
+	max_matches = min_t(unsigned int, req.max_matches, AESD_SEARCH_MATCHES_MAX);
+	pat = memdup_user((const void __user *)(uintptr_t)req.pattern, req.pattern_len);
+	if (IS_ERR(pat)) {
+		return PTR_ERR(pat);
+	}
+	sampled = kmalloc_array(AESD_SEARCH_ENTRIES_MAX, sizeof(*sampled), GFP_KERNEL);
+	matches = kmalloc_array(max_matches, sizeof(*matches), GFP_KERNEL);
+	if (!sampled || !matches) {
+		result = -ENOMEM;
+		goto out;
 	}
-	
-	if (mutex_lock_interruptible(&devp->lock)) 
-    {
-        retval = -ERESTARTSYS;
-        goto exit;
-    }
-	
-	struct aesd_buffer_entry *buf_entry;
-	size_t offset;
-	buf_entry = aesd_circular_buffer_find_entry_offset_for_fpos(&devp->buf, *f_pos, &offset);
-    if (!buf_entry) 
-    {
-        retval = 0;
-        goto unlock_mutex;
-    }
-	
-	size_t bytes_to_copy;
-	bytes_to_copy = min(count, buf_entry->size - offset);
-	
-	if (copy_to_user(buf, buf_entry->buffptr + offset, bytes_to_copy)) 
-    {
-        retval = -EFAULT;
-        goto unlock_mutex;
-    }
 
-    *f_pos += bytes_to_copy;
-    retval = bytes_to_copy;
-	
-	unlock_mutex:
-		mutex_unlock(&devp->lock);
-	exit:	
-    	return retval;
+	srcu_idx = srcu_read_lock(&devp->srcu);
+	// Evicted commands stay searchable until srcu_read_unlock, only a reused ring needs a retry
+	do {
+		n = aesd_search_sample(devp, req.start, sampled, &more);
+		count = 0;
+		result = 0;
+		for (i = 0; i < n && count < max_matches && !result; i++) {
+			result = aesd_search_entry(devp, &sampled[i], req.start + i,
+					i == 0 ? req.start_offset : 0, pat, req.pattern_len,
+					matches, &count, max_matches);
+			// Commands may be large, do not hog the CPU across all of them
+			cond_resched();
+		}
+	} while (result == -EAGAIN);
+	srcu_read_unlock(&devp->srcu, srcu_idx);
+
+	if (count == max_matches) {
+		// The next call continues right after the last match
+		req.start = matches[count - 1].index;
+		req.start_offset = matches[count - 1].offset + 1;
+		req.done = 0;
+	} else {
+		req.start += n;
+		req.start_offset = 0;
+		req.done = !more;
+	}
+	req.count = count;
+	if (copy_to_user((void __user *)(uintptr_t)req.matches, matches, count * sizeof(*matches)) ||
+			copy_to_user(arg, &req, sizeof(req))) {
+		result = -EFAULT;
+	}
+out:
+	kfree(pat);
+	kfree(sampled);
+	kfree(matches);
+	return result;
 }
 
-ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
-                   loff_t *f_pos)
+/*
+ * @return the size of a snapshot of @buffer and a pending command of @pending bytes, see
+ * struct aesd_snapshot_header
+ */
+static uint64_t aesd_snapshot_size(struct aesd_circular_buffer *buffer, size_t pending)
 {
-    ssize_t retval = -ENOMEM;
-    PDEBUG("write %zu bytes with offset %lld", count, *f_pos);
+	return sizeof(struct aesd_snapshot_header) +
+			(aesd_circular_buffer_count(buffer) + 1) * sizeof(uint64_t) +
+			aesd_circular_buffer_size(buffer) + pending;
+}
 
-    // Validate inputs
-    if (!filp || !buf) {
-        retval = -EINVAL;
-        goto exit;
-    }
+/*
+ * Serializes the commands of @buffer and the pending command of @file into @snap of
+ * @bytes bytes, see struct aesd_snapshot_header.  Caller holds the device lock and the
+ * pending lock of @file, so the byte ring cannot be reused under the copy.
+ */
+static void aesd_snapshot_fill(struct aesd_file *file, struct aesd_circular_buffer *buffer,
+		char *snap, uint64_t bytes)
+{
+	struct aesd_snapshot_header *hdr = (struct aesd_snapshot_header *)snap;
+	uint64_t *sizes = (uint64_t *)(hdr + 1);
+	struct aesd_buffer_entry *entry;
+	char *data;
+	size_t chunk;
+	unsigned int i;
 
-    // Get a reference to the device structure
-    struct aesd_dev *devp = filp->private_data;
-    if (!devp) {
-        retval = -EPERM;
-        goto exit;
-    }
+	hdr->magic = AESD_SNAPSHOT_MAGIC;
+	hdr->version = AESD_SNAPSHOT_VERSION;
+	hdr->count = aesd_circular_buffer_count(buffer);
+	hdr->capacity = buffer->capacity;
+	hdr->bytes = bytes;
+	data = (char *)(sizes + hdr->count + 1);
+	for (i = 0; i < hdr->count; i++) {
+		entry = aesd_circular_buffer_get_entry(buffer, i, NULL);
+		sizes[i] = entry->size;
+		if (entry->buffptr) {
+			memcpy(data, entry->buffptr, entry->size);
+		} else {
+			chunk = min(entry->size,
+					buffer->ring_size - (entry->offs & (buffer->ring_size - 1)));
+			memcpy(data, aesd_circular_buffer_ring_ptr(buffer, entry->offs), chunk);
+			memcpy(data + chunk, buffer->ring, entry->size - chunk);
+		}
+		data += entry->size;
+	}
+	sizes[hdr->count] = file->entry.size;
+	if (file->entry.size) {
+		memcpy(data, file->entry.buffptr, file->entry.size);
+	}
+}
 
-    // Allocate temporary buffer for user data
-    char *temp = kmalloc(count, GFP_KERNEL);
-    if (!temp) {
-        retval = -ENOMEM;
-        goto exit;
-    }
+/*
+ * Serializes the commands of the device and the pending command of @file, see
+ * AESDCHAR_IOCEXPORT.  The snapshot is built in a kernel buffer under the device lock and
+ * only copied to the caller once the lock is dropped, so a slow user buffer never stalls
+ * writers.
+ */
+static long aesd_export(struct aesd_file *file, struct aesd_snapshot __user *arg)
+{
+	struct aesd_dev *devp = file->dev;
+	struct aesd_snapshot req;
+	char *snap = NULL;
+	uint64_t snap_size = 0;
+	long result = 0;
 
-    // Copy data from user space
-    if (copy_from_user(temp, buf, count)) {
-        retval = -EFAULT;
-        kfree(temp);
-        goto exit;
-    }
+	if (copy_from_user(&req, arg, sizeof(req))) {
+		return -EFAULT;
+	}
+	for (;;) {
+		if (mutex_lock_interruptible(&file->pending_lock)) {
+			result = -ERESTARTSYS;
+			goto out;
+		}
+		if (mutex_lock_interruptible(&devp->lock)) {
+			mutex_unlock(&file->pending_lock);
+			result = -ERESTARTSYS;
+			goto out;
+		}
+		req.bytes = aesd_snapshot_size(aesd_locked_buf(devp), file->entry.size);
+		if (req.bytes > req.buf_size) {
+			result = -ENOSPC;
+			break;
+		}
+		if (req.bytes <= snap_size) {
+			aesd_snapshot_fill(file, aesd_locked_buf(devp), snap, req.bytes);
+			break;
+		}
+		// Allocate without the locks held, and start over in case the device grew meanwhile
+		mutex_unlock(&devp->lock);
+		mutex_unlock(&file->pending_lock);
+		kvfree(snap);
+		snap_size = req.bytes;
+		snap = kvmalloc(snap_size, GFP_KERNEL);
+		if (!snap) {
+			return -ENOMEM;
+		}
+	}
+	mutex_unlock(&devp->lock);
+	mutex_unlock(&file->pending_lock);
 
-    // Find end of text ('\n')
-    char *end_of_text = memchr(temp, '\n', count);
-    size_t write_bytes = count;
-    if (end_of_text) {
-        write_bytes = end_of_text - temp + 1;
-    }
+	if (!result && copy_to_user((void __user *)(uintptr_t)req.buf, snap, req.bytes)) {
+		result = -EFAULT;
+	}
+	// The size needed is reported along with ENOSPC
+	if ((!result || result == -ENOSPC) && copy_to_user(arg, &req, sizeof(req))) {
+		result = -EFAULT;
+	}
+out:
+	kvfree(snap);
+	return result;
+}
 
-    // Lock mutex to protect shared data
-    if (mutex_lock_interruptible(&devp->lock)) {
-        retval = -ERESTARTSYS;
-        kfree(temp);
-        goto exit;
-    }	
-	
-    // Reallocate memory for the entry buffer
-    devp->entry.buffptr = krealloc(devp->entry.buffptr, devp->entry.size + write_bytes, GFP_KERNEL);
-    if (!devp->entry.buffptr) {
-        retval = -ENOMEM;
-        mutex_unlock(&devp->lock);
-        kfree(temp);
-        goto exit;
-    }
+/*
+ * Reads the command of @size bytes at @src into a new command buffer, checking that it
+ * is a single line
+ * @return the buffptr of the command or an ERR_PTR
+ */
+static const char *aesd_cmd_from_user(const char __user *src, size_t size)
+{
+	struct aesd_cmd *cmd;
 
-    // Copy data to entry buffer
-    memcpy(devp->entry.buffptr + devp->entry.size, temp, write_bytes);
-    kfree(temp);
-    devp->entry.size += write_bytes;
+	if (size == 0) {
+		return ERR_PTR(-EINVAL);
+	}
+	cmd = aesd_cmd_alloc(size);
+	if (!cmd) {
+		return ERR_PTR(-ENOMEM);
+	}
+	if (copy_from_user(cmd->data, src, size)) {
+		aesd_cmd_destroy(cmd);
+		return ERR_PTR(-EFAULT);
+	}
+	if (memchr(cmd->data, '\n', size) != cmd->data + size - 1) {
+		aesd_cmd_destroy(cmd);
+		return ERR_PTR(-EINVAL);
+	}
+	return cmd->data;
+}
 
-    // Add entry to circular buffer if end of text is found
-    if (end_of_text) {
-        const char *bufp = aesd_circular_buffer_add_entry(&devp->buf, &devp->entry);
-        if (bufp) {
-		//if (devp->buf.full) {
-		    kfree(bufp); // Free memory associated with overwritten entry if circular buffer is full
-			//}
-	    }
-		
-        devp->entry.size = 0;
-        devp->entry.buffptr = NULL;
-    }
+/*
+ * Replaces the commands of the device and the pending command of @file with a snapshot,
+ * see AESDCHAR_IOCIMPORT.  Everything is read and checked before the device is touched,
+ * so a rejected snapshot leaves it as it was.
+ */
+static long aesd_import(struct aesd_file *file, struct aesd_snapshot __user *arg)
+{
+	struct aesd_dev *devp = file->dev;
+	struct aesd_circular_buffer *buffer;
+	struct aesd_snapshot req;
+	struct aesd_snapshot_header hdr;
+	const char __user *src;
+	const char **cmds = NULL;
+	uint64_t *sizes = NULL;
+	uint64_t table_end, total;
+	unsigned int i, n = 0;
+	long result = 0;
 
-    mutex_unlock(&devp->lock);
-    retval = write_bytes;
+	if (copy_from_user(&req, arg, sizeof(req))) {
+		return -EFAULT;
+	}
+	src = (const char __user *)(uintptr_t)req.buf;
+	if (req.buf_size < sizeof(hdr)) {
+		return -EINVAL;
+	}
+	if (copy_from_user(&hdr, src, sizeof(hdr))) {
+		return -EFAULT;
+	}
+	table_end = sizeof(hdr) + ((uint64_t)hdr.count + 1) * sizeof(*sizes);
+	if (hdr.magic != AESD_SNAPSHOT_MAGIC || hdr.version != AESD_SNAPSHOT_VERSION ||
+			hdr.count > AESDCHAR_MAX_CAPACITY || hdr.bytes > req.buf_size || hdr.bytes < table_end) {
+		return -EINVAL;
+	}
+	sizes = vmemdup_user(src + sizeof(hdr), table_end - sizeof(hdr));
+	if (IS_ERR(sizes)) {
+		return PTR_ERR(sizes);
+	}
+	total = table_end;
+	for (i = 0; i <= hdr.count; i++) {
+		// Compared one at a time so a forged size cannot wrap the sum
+		if (sizes[i] > hdr.bytes - total) {
+			result = -EINVAL;
+			goto out;
+		}
+		total += sizes[i];
+	}
+	if (total != hdr.bytes) {
+		result = -EINVAL;
+		goto out;
+	}
 
-exit:
-    return retval;
-}
+	cmds = kvmalloc_array(max(hdr.count, 1U), sizeof(*cmds), GFP_KERNEL);
+	if (!cmds) {
+		result = -ENOMEM;
+		goto out;
+	}
+	src += table_end;
+	for (n = 0; n < hdr.count; n++) {
+		if (aesd_cmd_too_big(devp, sizes[n])) {
+			result = -EFBIG;
+			goto out;
+		}
+		cmds[n] = aesd_cmd_from_user(src, sizes[n]);
+		if (IS_ERR(cmds[n])) {
+			result = PTR_ERR(cmds[n]);
+			goto out;
+		}
+		src += sizes[n];
+		cond_resched();
+	}
 
-loff_t aesd_llseek(struct file *filp, loff_t off, int operation) {
-	
-	struct aesd_dev *devp = filp->private_data;
-	size_t size = 0, i;
-	loff_t f_pos;
-	
-	switch(operation) {
-		case SEEK_SET: 
-			f_pos = off;
-			break;
-		case SEEK_CUR:
-			f_pos = filp->f_pos + off;
-			break;
-		case SEEK_END:
-			if (mutex_lock_interruptible(&devp->lock)) {
-				return -ERESTARTSYS;
-			}
-			for(i = devp->buf.out_offs; i != devp->buf.in_offs; i++) {
-				size += devp->buf.entry[i].size;
-				i %= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-			}
-			mutex_unlock(&devp->lock);
-			f_pos = size + off;
-			break;
-		default:
-			return -EINVAL;
+	// Lock order is pending_lock, then the device lock
+	if (mutex_lock_interruptible(&file->pending_lock)) {
+		result = -ERESTARTSYS;
+		goto out;
 	}
-	filp->f_pos = f_pos;
-	return f_pos;
-	
+	if (file->entry.size) {
+		result = -EBUSY;
+		goto unlock_pending;
+	}
+	if (aesd_cmd_too_big(devp, sizes[hdr.count])) {
+		result = -EFBIG;
+		goto unlock_pending;
+	}
+	if (aesd_reserve_pending(file, sizes[hdr.count])) {
+		result = -ENOMEM;
+		goto unlock_pending;
+	}
+	// Staged while entry.size stays 0, the pending command only changes once the import succeeds
+	if (copy_from_user((char *)file->entry.buffptr, src, sizes[hdr.count])) {
+		result = -EFAULT;
+		goto unlock_pending;
+	}
+	if (sizes[hdr.count] && memchr(file->entry.buffptr, '\n', sizes[hdr.count])) {
+		result = -EINVAL;
+		goto unlock_pending;
+	}
+	if (mutex_lock_interruptible(&devp->lock)) {
+		result = -ERESTARTSYS;
+		goto unlock_pending;
+	}
+	if (atomic_read(&devp->open_count) > 1) {
+		result = -EBUSY;
+		goto unlock_dev;
+	}
+
+	buffer = aesd_locked_buf(devp);
+	write_seqcount_begin(&devp->seq);
+	while (aesd_circular_buffer_count(buffer)) {
+		aesd_cmd_release(devp, aesd_circular_buffer_remove_entry(buffer));
+	}
+	write_seqcount_end(&devp->seq);
+	if (devp->mmap_hdr) {
+		aesd_mmap_write_begin(devp->mmap_hdr);
+		aesd_mmap_trim(devp->mmap_hdr, buffer->end_offs - buffer->total_size);
+		aesd_mmap_write_end(devp->mmap_hdr);
+	}
+	// Running offsets carry on from the discarded commands, as after any eviction
+	for (i = 0; i < hdr.count; i++) {
+		aesd_add_command(devp, cmds[i], sizes[i]);
+		// The ring keeps its own copy
+		if (devp->ring_size) {
+			aesd_cmd_free(cmds[i]);
+		}
+	}
+	n = 0;
+	file->entry.size = sizes[hdr.count];
+	req.bytes = hdr.bytes;
+
+unlock_dev:
+	mutex_unlock(&devp->lock);
+unlock_pending:
+	mutex_unlock(&file->pending_lock);
+	if (!result && copy_to_user(arg, &req, sizeof(req))) {
+		result = -EFAULT;
+	}
+out:
+	while (n) {
+		aesd_cmd_free(cmds[--n]);
+	}
+	kvfree(cmds);
+	kvfree(sizes);
+	return result;
 }
 
-long int aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
-	struct aesd_dev *devp = filp->private_data;
+static long aesd_do_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+	struct aesd_file *file = filp->private_data;
+	struct aesd_dev *devp = file->dev;
 	struct aesd_seekto seekto;
-	size_t index, i, size = 0;
+	uint32_t capacity, tail;
+	struct aesd_buffer_entry *buf_entry;
+	unsigned long generation;
+	unsigned int seq;
+	size_t fpos, pos_offs;
+	int srcu_idx;
+	bool valid;
 	
 	switch (cmd) {
 		case AESDCHAR_IOCSEEKTO:
 			if(copy_from_user(&seekto, (struct aesd_seekto *)arg, sizeof(struct aesd_seekto))) {
 				return -EFAULT;
 			}			
-			if(seekto.write_cmd > AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED) {
+			srcu_idx = srcu_read_lock(&devp->srcu);
+			do {
+				struct aesd_circular_buffer *buffer;
+				seq = read_seqcount_begin(&devp->seq);
+				buffer = srcu_dereference(devp->buf, &devp->srcu);
+				buf_entry = aesd_circular_buffer_get_entry(buffer, seekto.write_cmd, &fpos);
+				valid = buf_entry && seekto.write_cmd_offset <= buf_entry->size;
+				pos_offs = valid ? buf_entry->offs : 0;
+				generation = buffer->generation;
+			} while (read_seqcount_retry(&devp->seq, seq));
+			srcu_read_unlock(&devp->srcu, srcu_idx);
+			if(!valid) {
 				return -EINVAL;
 			}
-			if (mutex_lock_interruptible(&devp->lock)) {
+			if (mutex_lock_interruptible(&file->cursor_lock)) {
 				return -ERESTARTSYS;
 			}
-			index = devp->buf.out_offs + seekto.write_cmd;
-			index %= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-			if(seekto.write_cmd_offset > devp->buf.entry[index].size) {
-				mutex_unlock(&devp->lock);
+			filp->f_pos = fpos + seekto.write_cmd_offset;
+			aesd_cursor_set(file, filp->f_pos, seekto.write_cmd, seekto.write_cmd_offset, generation);
+			WRITE_ONCE(file->pos_offs, pos_offs + seekto.write_cmd_offset);
+			mutex_unlock(&file->cursor_lock);
+			// A tail reader of this file sleeping on the old position looks at the new one
+			wake_up_interruptible(&devp->wait);
+			return 0;
+		case AESDCHAR_IOCSETCAPACITY:
+			if(copy_from_user(&capacity, (uint32_t *)arg, sizeof(capacity))) {
+				return -EFAULT;
+			}
+			if(capacity == 0 || capacity > AESDCHAR_MAX_CAPACITY) {
 				return -EINVAL;
 			}
-			for(i = devp->buf.out_offs; i != index; i++) {
-				size += devp->buf.entry[i].size;
-				i %= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+			return aesd_set_capacity(file, capacity);
+		case AESDCHAR_IOCREADENTRIES:
+			return aesd_read_entries(devp, (struct aesd_read_entries __user *)arg);
+		case AESDCHAR_IOCSEARCH:
+			return aesd_search(devp, (struct aesd_search __user *)arg);
+		case AESDCHAR_IOCGSTATS:
+			return aesd_get_stats(file, (struct aesd_stats __user *)arg);
+		case AESDCHAR_IOCEXPORT:
+			return aesd_export(file, (struct aesd_snapshot __user *)arg);
+		case AESDCHAR_IOCIMPORT:
+			return aesd_import(file, (struct aesd_snapshot __user *)arg);
+		case AESDCHAR_IOCSETTAIL:
+			if(copy_from_user(&tail, (uint32_t *)arg, sizeof(tail))) {
+				return -EFAULT;
 			}
-			filp->f_pos = size + seekto.write_cmd_offset;
-			mutex_unlock(&devp->lock);
+			file->tail = tail != 0;
 			return 0;
 		default:
 			return -EINVAL;
@@ -267,56 +1711,319 @@ long int aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
 	}
 }
 
+long int aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+	struct aesd_file *file = filp->private_data;
+	long result = aesd_do_ioctl(filp, cmd, arg);
+
+	trace_aesd_ioctl(file->dev, cmd, result);
+	return result;
+}
+
+/*
+ * Maps the header page and data ring read-only, see struct aesd_mmap_header
+ */
+static int aesd_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct aesd_file *file = filp->private_data;
+	struct aesd_dev *devp = file->dev;
+
+	if (!devp->mmap_hdr) {
+		return -ENODEV;
+	}
+	if (vma->vm_flags & VM_WRITE) {
+		return -EPERM;
+	}
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+	vm_flags_clear(vma, VM_MAYWRITE);
+#else
+	vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+	return remap_vmalloc_range(vma, devp->mmap_hdr, vma->vm_pgoff);
+}
+
 struct file_operations aesd_fops = {
     .owner          = THIS_MODULE,
-    .read           = aesd_read,
-    .write          = aesd_write,
+    .read_iter      = aesd_read_iter,
+    .write_iter     = aesd_write_iter,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+    .splice_read    = copy_splice_read,
+#else
+    .splice_read    = generic_file_splice_read,
+#endif
+    .splice_write   = iter_file_splice_write,
     .open           = aesd_open,
     .release        = aesd_release,
     .llseek         = aesd_llseek,
     .unlocked_ioctl = aesd_ioctl,
+    .poll           = aesd_poll,
+    .mmap           = aesd_mmap,
+};
+
+/*
+ * Statistics of each device, read-only: one file per value under
+ * /sys/class/aesdchar/aesdchar<N>/ and a summary in <debugfs>/aesdchar/aesdchar<N>
+ */
+static struct class *aesd_class;
+static struct dentry *aesd_debugfs_dir;
+
+#define AESD_COUNTER_ATTR(_name)						\
+static ssize_t _name##_show(struct device *dev, struct device_attribute *attr, char *buf) \
+{										\
+	struct aesd_counters sum;						\
+	aesd_counters_sum(dev_get_drvdata(dev), &sum);				\
+	return sysfs_emit(buf, "%llu\n", sum._name);				\
+}										\
+static DEVICE_ATTR_RO(_name)
+
+AESD_COUNTER_ATTR(write_bytes);
+AESD_COUNTER_ATTR(write_cmds);
+AESD_COUNTER_ATTR(reads);
+AESD_COUNTER_ATTR(read_bytes);
+AESD_COUNTER_ATTR(evictions);
+AESD_COUNTER_ATTR(fragments);
+AESD_COUNTER_ATTR(lock_wait_ns);
+
+/*
+ * Samples the bytes and commands currently held by @devp without taking its lock
+ */
+static void aesd_held(struct aesd_dev *devp, size_t *bytes, unsigned int *entries)
+{
+	struct aesd_circular_buffer *buffer;
+	unsigned int seq;
+	int srcu_idx = srcu_read_lock(&devp->srcu);
+
+	do {
+		seq = read_seqcount_begin(&devp->seq);
+		buffer = srcu_dereference(devp->buf, &devp->srcu);
+		*bytes = aesd_circular_buffer_size(buffer);
+		*entries = aesd_circular_buffer_count(buffer);
+	} while (read_seqcount_retry(&devp->seq, seq));
+	srcu_read_unlock(&devp->srcu, srcu_idx);
+}
+
+static ssize_t bytes_held_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	size_t bytes;
+	unsigned int entries;
+
+	aesd_held(dev_get_drvdata(dev), &bytes, &entries);
+	return sysfs_emit(buf, "%zu\n", bytes);
+}
+static DEVICE_ATTR_RO(bytes_held);
+
+static ssize_t entries_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	size_t bytes;
+	unsigned int entries;
+
+	aesd_held(dev_get_drvdata(dev), &bytes, &entries);
+	return sysfs_emit(buf, "%u\n", entries);
+}
+static DEVICE_ATTR_RO(entries);
+
+static struct attribute *aesd_dev_attrs[] = {
+	&dev_attr_write_bytes.attr,
+	&dev_attr_write_cmds.attr,
+	&dev_attr_reads.attr,
+	&dev_attr_read_bytes.attr,
+	&dev_attr_evictions.attr,
+	&dev_attr_fragments.attr,
+	&dev_attr_lock_wait_ns.attr,
+	&dev_attr_bytes_held.attr,
+	&dev_attr_entries.attr,
+	NULL,
 };
+ATTRIBUTE_GROUPS(aesd_dev);
+
+static int aesd_debugfs_show(struct seq_file *m, void *unused)
+{
+	struct aesd_dev *devp = m->private;
+	struct aesd_counters sum;
+	size_t bytes;
+	unsigned int entries;
+
+	aesd_counters_sum(devp, &sum);
+	aesd_held(devp, &bytes, &entries);
+	seq_printf(m, "bytes_held:   %zu\n", bytes);
+	seq_printf(m, "entries:      %u\n", entries);
+	seq_printf(m, "write_bytes:  %llu\n", sum.write_bytes);
+	seq_printf(m, "write_cmds:   %llu\n", sum.write_cmds);
+	seq_printf(m, "reads:        %llu\n", sum.reads);
+	seq_printf(m, "read_bytes:   %llu\n", sum.read_bytes);
+	seq_printf(m, "evictions:    %llu\n", sum.evictions);
+	seq_printf(m, "fragments:    %llu\n", sum.fragments);
+	seq_printf(m, "lock_wait_ns: %llu\n", sum.lock_wait_ns);
+	seq_printf(m, "open_count:   %d\n", atomic_read(&devp->open_count));
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(aesd_debugfs);
 
-static int aesd_setup_cdev(struct aesd_dev *dev)
+static int aesd_setup_cdev(struct aesd_dev *dev, unsigned int index)
 {
-    int err, devno = MKDEV(aesd_major, aesd_minor);
+    int err, devno = MKDEV(aesd_major, aesd_minor + index);
 
     cdev_init(&dev->cdev, &aesd_fops);
     dev->cdev.owner = THIS_MODULE;
     dev->cdev.ops = &aesd_fops;
     err = cdev_add (&dev->cdev, devno, 1);
     if (err) {
-        printk(KERN_ERR "Error %d adding aesd cdev", err);
+        printk(KERN_ERR "Error %d adding aesd cdev %u", err, index);
     }
     return err;
 }
 
+/*
+ * Initializes device @index with its own buffer, locks and mapping and makes it live
+ */
+static int aesd_dev_init(struct aesd_dev *devp, unsigned int index)
+{
+    struct aesd_circular_buffer *buffer;
+    char name[16];
+    int result;
+
+	mutex_init(&devp->lock);
+	seqcount_mutex_init(&devp->seq, &devp->lock);
+	init_waitqueue_head(&devp->wait);
+    devp->counters = alloc_percpu(struct aesd_counters);
+    if( !devp->counters ) {
+        return -ENOMEM;
+    }
+    result = init_srcu_struct(&devp->srcu);
+    if( result ) {
+        goto fail_srcu;
+    }
+    buffer = kmalloc(sizeof(struct aesd_circular_buffer), GFP_KERNEL);
+    result = buffer ? aesd_circular_buffer_init_capacity(buffer, aesd_max_entries) : -ENOMEM;
+    if( result ) {
+        printk(KERN_WARNING "Can't allocate %u aesdchar entries\n", aesd_max_entries);
+        goto fail_buffer;
+    }
+    RCU_INIT_POINTER(devp->buf, buffer);
+    // A byte ring is allocated as the data of the mapping, so mmap readers see it directly
+    result = aesd_mmap_init(devp, aesd_ring_size ? aesd_ring_size : aesd_mmap_size);
+    if( result ) {
+        printk(KERN_WARNING "Can't allocate %u bytes for aesdchar mmap\n",
+                aesd_ring_size ? aesd_ring_size : aesd_mmap_size);
+        goto fail_mmap;
+    }
+    if( aesd_ring_size ) {
+        aesd_circular_buffer_attach_ring(buffer, devp->mmap_data, devp->mmap_hdr->data_size);
+        devp->ring_size = devp->mmap_hdr->data_size;
+    }
+    result = aesd_setup_cdev(devp, index);
+    if( result ) {
+        goto fail_cdev;
+    }
+    devp->device = device_create_with_groups(aesd_class, NULL, devp->cdev.dev, devp,
+            aesd_dev_groups, "aesdchar%u", index);
+    if( IS_ERR(devp->device) ) {
+        result = PTR_ERR(devp->device);
+        goto fail_device;
+    }
+    // debugfs is best effort, errors are deliberately ignored
+    snprintf(name, sizeof(name), "aesdchar%u", index);
+    debugfs_create_file(name, 0444, aesd_debugfs_dir, devp, &aesd_debugfs_fops);
+    return 0;
+
+fail_device:
+    cdev_del(&devp->cdev);
+fail_cdev:
+    vfree(devp->mmap_hdr);
+fail_mmap:
+    aesd_circular_buffer_free(buffer);
+fail_buffer:
+    kfree(buffer);
+    cleanup_srcu_struct(&devp->srcu);
+fail_srcu:
+    free_percpu(devp->counters);
+    return result;
+}
+
+/*
+ * Removes a device set up by aesd_dev_init() and frees every command it holds
+ */
+static void aesd_dev_cleanup(struct aesd_dev *devp)
+{
+	unsigned int idx = 0;
+	struct aesd_buffer_entry *buf_entry;
+	struct aesd_circular_buffer *buffer = rcu_dereference_protected(devp->buf, 1);
+
+    device_unregister(devp->device);
+    cdev_del(&devp->cdev);
 
+	// Let deferred frees of evicted commands finish before tearing srcu down
+	srcu_barrier(&devp->srcu);
+	AESD_CIRCULAR_BUFFER_FOREACH(buf_entry, buffer, idx) 
+    {
+        aesd_cmd_free(buf_entry->buffptr);
+    }
+    aesd_circular_buffer_free(buffer);
+    kfree(buffer);
+    vfree(devp->mmap_hdr);
+    cleanup_srcu_struct(&devp->srcu);
+    free_percpu(devp->counters);
+    mutex_destroy(&devp->lock);
+}
 
 int aesd_init_module(void)
 {
     dev_t dev = 0;
+    unsigned int i;
     int result;
-    result = alloc_chrdev_region(&dev, aesd_minor, 1,
+    if( aesd_nr_devs == 0 ) {
+        return -EINVAL;
+    }
+    result = alloc_chrdev_region(&dev, aesd_minor, aesd_nr_devs,
             "aesdchar");
     aesd_major = MAJOR(dev);
     if (result < 0) {
         printk(KERN_WARNING "Can't get major %d\n", aesd_major);
         return result;
     }
-    memset(&aesd_device,0,sizeof(struct aesd_dev));
 
     /**
      * TODO: initialize the AESD specific portion of the device
      */
 
-	mutex_init(&aesd_device.lock);
-    aesd_circular_buffer_init(&aesd_device.buf);	
-    result = aesd_setup_cdev(&aesd_device);
-
+    result = aesd_cmd_caches_init();
     if( result ) {
-        unregister_chrdev_region(dev, 1);
+        goto fail_caches;
+    }
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+    aesd_class = class_create("aesdchar");
+#else
+    aesd_class = class_create(THIS_MODULE, "aesdchar");
+#endif
+    if( IS_ERR(aesd_class) ) {
+        result = PTR_ERR(aesd_class);
+        goto fail_class;
     }
+    aesd_devices = kcalloc(aesd_nr_devs, sizeof(struct aesd_dev), GFP_KERNEL);
+    if( !aesd_devices ) {
+        result = -ENOMEM;
+        goto fail_devices;
+    }
+    aesd_debugfs_dir = debugfs_create_dir("aesdchar", NULL);
+    for( i = 0; i < aesd_nr_devs; i++ ) {
+        result = aesd_dev_init(&aesd_devices[i], i);
+        if( result ) {
+            goto fail_dev;
+        }
+    }
+    return 0;
+
+fail_dev:
+    debugfs_remove_recursive(aesd_debugfs_dir);
+    while( i-- ) {
+        aesd_dev_cleanup(&aesd_devices[i]);
+    }
+    kfree(aesd_devices);
+fail_devices:
+    class_destroy(aesd_class);
+fail_class:
+    aesd_cmd_caches_destroy();
+fail_caches:
+    unregister_chrdev_region(dev, aesd_nr_devs);
     return result;
 
 }
@@ -324,21 +2031,21 @@ int aesd_init_module(void)
 void aesd_cleanup_module(void)
 {
     dev_t devno = MKDEV(aesd_major, aesd_minor);
-
-    cdev_del(&aesd_device.cdev);
+    unsigned int i;
 
     /**
      * TODO: cleanup AESD specific poritions here as necessary
      */
 	
-	uint8_t idx = 0;
-	struct aesd_buffer_entry *buf_entry;
-	AESD_CIRCULAR_BUFFER_FOREACH(buf_entry, &aesd_device.buf, idx) 
-    {
-        kfree(buf_entry->buffptr);
+    // Remove the debugfs files first, they point into aesd_devices
+    debugfs_remove_recursive(aesd_debugfs_dir);
+    for( i = 0; i < aesd_nr_devs; i++ ) {
+        aesd_dev_cleanup(&aesd_devices[i]);
     }
-    mutex_destroy(&aesd_device.lock);
-    unregister_chrdev_region(devno, 1);
+    kfree(aesd_devices);
+    class_destroy(aesd_class);
+    aesd_cmd_caches_destroy();
+    unregister_chrdev_region(devno, aesd_nr_devs);
 }
 
 module_init(aesd_init_module);
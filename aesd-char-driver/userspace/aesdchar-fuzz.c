@@ -0,0 +1,439 @@
+/**
+ * @file    aesdchar-fuzz.c
+ * @brief   Fuzz driver of the aesdchar driver built for userspace. Each input is decoded
+ *          into a sequence of writes, reads, seeks, ioctls, opens and closes on a few files
+ *          of one freshly loaded device, and every result is checked against a simple
+ *          model of the stored commands. After each operation the commands read back with
+ *          AESDCHAR_IOCREADENTRIES must equal the model. A mismatch aborts, so the fuzzer
+ *          keeps the input.
+ *
+ *          Built with -DAESD_LIBFUZZER and -fsanitize=fuzzer this is a libFuzzer target.
+ *          Otherwise main() replays the input files given on the command line, or with
+ *          none a fixed series of pseudo random inputs, so it also runs as a plain test.
+ *
+ *          Usage: aesdchar-fuzz [input file...]
+ *
+ * @author  Suhas-Reddy-S
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "aesdchar-user.h"
+#include "../aesd-circular-buffer.h"
+
+#define FUZZ_FILES 3
+#define FUZZ_CAPACITY 4
+#define FUZZ_MAX_CAPACITY 9
+#define FUZZ_MATCHES_MAX 64
+#define FUZZ_DEFAULT_INPUTS 2000
+#define FUZZ_DEFAULT_INPUT_SIZE 512
+
+#define FUZZ_CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            abort(); \
+        } \
+    } while (0)
+
+enum fuzz_op {
+    FUZZ_WRITE,
+    FUZZ_READ,
+    FUZZ_LLSEEK,
+    FUZZ_SEEKTO,
+    FUZZ_SETCAPACITY,
+    FUZZ_STATS,
+    FUZZ_SEARCH,
+    FUZZ_SNAPSHOT,
+    FUZZ_REOPEN,
+    FUZZ_NR_OPS
+};
+
+struct fuzz_bytes {
+    char *data;
+    size_t size;
+};
+
+// What the device should hold
+struct fuzz_model {
+    struct fuzz_bytes cmds[FUZZ_MAX_CAPACITY + 1];	/* oldest first, one over while evicting */
+    unsigned int count;
+    unsigned int capacity;
+    struct fuzz_bytes pending[FUZZ_FILES];
+    struct file *files[FUZZ_FILES];	/* NULL while closed */
+    char *flat;	/* the commands back to back, rebuilt by model_flatten() */
+    size_t total;
+};
+
+struct fuzz_input {
+    const uint8_t *data;
+    size_t size;
+};
+
+static uint8_t next_byte(struct fuzz_input *in)
+{
+    if (!in->size) {
+        return 0;
+    }
+    in->size--;
+    return *in->data++;
+}
+
+// Command bytes are letters with a newline one time in eight, so commands complete often
+static char to_cmd_byte(uint8_t b)
+{
+    return b % 8 == 0 ? '\n' : 'a' + b % 26;
+}
+
+static void bytes_append(struct fuzz_bytes *bytes, const char *data, size_t size)
+{
+    bytes->data = realloc(bytes->data, bytes->size + size);
+    FUZZ_CHECK(bytes->data || !(bytes->size + size));
+    memcpy(bytes->data + bytes->size, data, size);
+    bytes->size += size;
+}
+
+static void model_evict(struct fuzz_model *model, unsigned int capacity)
+{
+    while (model->count > capacity) {
+        free(model->cmds[0].data);
+        memmove(&model->cmds[0], &model->cmds[1], (model->count - 1) * sizeof(model->cmds[0]));
+        model->count--;
+    }
+}
+
+static void model_flatten(struct fuzz_model *model)
+{
+    model->total = 0;
+    for (unsigned int i = 0; i < model->count; i++) {
+        model->total += model->cmds[i].size;
+    }
+    model->flat = realloc(model->flat, model->total + 1);
+    FUZZ_CHECK(model->flat);
+    for (size_t i = 0, pos = 0; i < model->count; pos += model->cmds[i].size, i++) {
+        memcpy(model->flat + pos, model->cmds[i].data, model->cmds[i].size);
+    }
+}
+
+static void model_write(struct fuzz_model *model, unsigned int f, const char *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        bytes_append(&model->pending[f], &data[i], 1);
+        if (data[i] == '\n') {
+            model->cmds[model->count++] = model->pending[f];
+            model->pending[f] = (struct fuzz_bytes){ 0 };
+            model_evict(model, model->capacity);
+        }
+    }
+}
+
+static unsigned int model_open_files(const struct fuzz_model *model)
+{
+    unsigned int open = 0;
+
+    for (unsigned int f = 0; f < FUZZ_FILES; f++) {
+        open += model->files[f] != NULL;
+    }
+    return open;
+}
+
+// The stored commands read back in one call must be those of the model
+static void check_entries(struct fuzz_model *model)
+{
+    size_t buf_size = AESD_READ_ENTRIES_MAX * sizeof(struct aesd_entry_desc) + model->total;
+    char *buf = malloc(buf_size);
+    struct aesd_read_entries req = { .max_count = AESD_READ_ENTRIES_MAX, .buf = (uintptr_t)buf, .buf_size = buf_size };
+    const struct aesd_entry_desc *desc = (const void *)buf;
+    struct file *filp;
+
+    FUZZ_CHECK(buf);
+    FUZZ_CHECK(aesd_user_open(0, 0, &filp) == 0);
+    FUZZ_CHECK(aesd_user_ioctl(filp, AESDCHAR_IOCREADENTRIES, &req) == 0);
+    FUZZ_CHECK(aesd_user_close(filp) == 0);
+    FUZZ_CHECK(req.count == model->count);
+    for (unsigned int i = 0, fpos = 0; i < model->count; fpos += model->cmds[i].size, i++) {
+        FUZZ_CHECK(desc[i].index == i && desc[i].fpos == fpos && desc[i].size == model->cmds[i].size);
+        FUZZ_CHECK(memcmp(buf + desc[i].data_offset, model->cmds[i].data, desc[i].size) == 0);
+    }
+    free(buf);
+}
+
+static void fuzz_read(struct fuzz_model *model, struct file *filp, size_t count)
+{
+    loff_t pos = filp->f_pos;
+    size_t avail = pos < (loff_t)model->total ? model->total - pos : 0;
+    char buf[256];
+    ssize_t ret = aesd_user_read(filp, buf, count);
+
+    FUZZ_CHECK(ret >= 0 && (size_t)ret <= min(count, avail));
+    FUZZ_CHECK(ret > 0 || count == 0 || avail == 0);
+    FUZZ_CHECK(memcmp(buf, model->flat + pos, ret) == 0);
+    FUZZ_CHECK(filp->f_pos == pos + ret);
+}
+
+static void fuzz_llseek(struct file *filp, const struct fuzz_model *model, int whence, loff_t off)
+{
+    loff_t base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? filp->f_pos : (loff_t)model->total;
+    loff_t ret = aesd_user_llseek(filp, off, whence);
+
+    FUZZ_CHECK(ret == (base + off < 0 ? -EINVAL : base + off));
+    FUZZ_CHECK(ret < 0 || filp->f_pos == ret);
+}
+
+static void fuzz_seekto(struct file *filp, const struct fuzz_model *model, uint32_t cmd, uint32_t offset)
+{
+    struct aesd_seekto seekto = { .write_cmd = cmd, .write_cmd_offset = offset };
+    loff_t fpos = 0, before = filp->f_pos;
+    long ret = aesd_user_ioctl(filp, AESDCHAR_IOCSEEKTO, &seekto);
+
+    for (uint32_t i = 0; i < cmd && i < model->count; i++) {
+        fpos += model->cmds[i].size;
+    }
+    if (cmd < model->count && offset <= model->cmds[cmd].size) {
+        FUZZ_CHECK(ret == 0 && filp->f_pos == fpos + offset);
+    } else {
+        FUZZ_CHECK(ret == -EINVAL && filp->f_pos == before);
+    }
+}
+
+static void fuzz_setcapacity(struct fuzz_model *model, unsigned int f, uint32_t capacity)
+{
+    long ret = aesd_user_ioctl(model->files[f], AESDCHAR_IOCSETCAPACITY, &capacity);
+
+    if (capacity == 0) {
+        FUZZ_CHECK(ret == -EINVAL);
+    } else if (model_open_files(model) > 1 || model->pending[f].size) {
+        FUZZ_CHECK(ret == -EBUSY);
+    } else {
+        FUZZ_CHECK(ret == 0);
+        model->capacity = capacity;
+        model_evict(model, capacity);
+    }
+}
+
+static void fuzz_stats(const struct fuzz_model *model, unsigned int f)
+{
+    struct aesd_stats stats;
+
+    FUZZ_CHECK(aesd_user_ioctl(model->files[f], AESDCHAR_IOCGSTATS, &stats) == 0);
+    FUZZ_CHECK(stats.entries == model->count && stats.bytes == model->total);
+    FUZZ_CHECK(stats.pending_bytes == model->pending[f].size && stats.capacity == model->capacity);
+}
+
+// Searches in calls of at most @param max_matches and compares with a naive search
+static void fuzz_search(const struct fuzz_model *model, struct file *filp, const char *pattern,
+        uint32_t pattern_len, uint32_t max_matches)
+{
+    struct aesd_search_match matches[FUZZ_MATCHES_MAX];
+    struct aesd_search search = {
+        .pattern = (uintptr_t)pattern, .pattern_len = pattern_len,
+        .max_matches = max_matches, .matches = (uintptr_t)matches,
+    };
+    unsigned int found = 0;
+    loff_t fpos = 0;
+
+    FUZZ_CHECK(max_matches <= FUZZ_MATCHES_MAX);
+    FUZZ_CHECK(aesd_user_ioctl(filp, AESDCHAR_IOCSEARCH, &search) == 0);
+    for (uint32_t i = 0; i < model->count; fpos += model->cmds[i].size, i++) {
+        for (uint32_t off = 0; off + pattern_len <= model->cmds[i].size; off++) {
+            if (memcmp(model->cmds[i].data + off, pattern, pattern_len)) {
+                continue;
+            }
+            if (found == search.count) {
+                FUZZ_CHECK(!search.done);
+                FUZZ_CHECK(aesd_user_ioctl(filp, AESDCHAR_IOCSEARCH, &search) == 0);
+                found = 0;
+            }
+            FUZZ_CHECK(found < search.count);
+            FUZZ_CHECK(matches[found].index == i && matches[found].offset == off);
+            FUZZ_CHECK(matches[found].fpos == (uint64_t)fpos + off);
+            found++;
+        }
+    }
+    // Calls past the last match may still be needed to reach the newest command
+    while (found == search.count && !search.done) {
+        FUZZ_CHECK(aesd_user_ioctl(filp, AESDCHAR_IOCSEARCH, &search) == 0);
+        found = 0;
+    }
+    FUZZ_CHECK(search.done && found == search.count);
+}
+
+// Exports a snapshot through file @param f, compares it with the model and imports it back
+static void fuzz_snapshot(const struct fuzz_model *model, unsigned int f)
+{
+    struct aesd_snapshot req = { 0 };
+    const struct aesd_snapshot_header *hdr;
+    const uint64_t *sizes;
+    const char *data;
+    char *snap;
+    long ret;
+
+    FUZZ_CHECK(aesd_user_ioctl(model->files[f], AESDCHAR_IOCEXPORT, &req) == -ENOSPC);
+    snap = malloc(req.bytes);
+    FUZZ_CHECK(snap);
+    req.buf = (uintptr_t)snap;
+    req.buf_size = req.bytes;
+    FUZZ_CHECK(aesd_user_ioctl(model->files[f], AESDCHAR_IOCEXPORT, &req) == 0);
+    hdr = (const void *)snap;
+    sizes = (const void *)(hdr + 1);
+    data = (const char *)(sizes + hdr->count + 1);
+    FUZZ_CHECK(hdr->count == model->count && hdr->capacity == model->capacity);
+    FUZZ_CHECK(hdr->bytes == req.bytes);
+    for (unsigned int i = 0; i < model->count; data += sizes[i], i++) {
+        FUZZ_CHECK(sizes[i] == model->cmds[i].size && memcmp(data, model->cmds[i].data, sizes[i]) == 0);
+    }
+    FUZZ_CHECK(sizes[model->count] == model->pending[f].size);
+    FUZZ_CHECK(!model->pending[f].size || memcmp(data, model->pending[f].data, model->pending[f].size) == 0);
+
+    // Importing what was just exported leaves the device as it was
+    ret = aesd_user_ioctl(model->files[f], AESDCHAR_IOCIMPORT, &req);
+    if (model->pending[f].size || model_open_files(model) > 1) {
+        FUZZ_CHECK(ret == -EBUSY);
+    } else {
+        FUZZ_CHECK(ret == 0);
+    }
+    free(snap);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    struct fuzz_input in = { data, size };
+    struct fuzz_model model = { .capacity = FUZZ_CAPACITY };
+    char chunk[256];
+
+    *kshim_param_aesd_max_entries = FUZZ_CAPACITY;
+    FUZZ_CHECK(aesd_user_load() == 0);
+    FUZZ_CHECK(aesd_user_open(0, 0, &model.files[0]) == 0);
+    model_flatten(&model);
+
+    while (in.size) {
+        uint8_t op = next_byte(&in);
+        unsigned int f = (op / FUZZ_NR_OPS) % FUZZ_FILES;
+        struct file *filp;
+        size_t len;
+
+        // Any operation on a closed file opens it first
+        if (!model.files[f]) {
+            FUZZ_CHECK(aesd_user_open(0, 0, &model.files[f]) == 0);
+            if (op % FUZZ_NR_OPS == FUZZ_REOPEN) {
+                continue;
+            }
+        }
+        filp = model.files[f];
+        switch (op % FUZZ_NR_OPS) {
+        case FUZZ_WRITE:
+            len = min((size_t)next_byte(&in), in.size);
+            for (size_t i = 0; i < len; i++) {
+                chunk[i] = to_cmd_byte(next_byte(&in));
+            }
+            FUZZ_CHECK(aesd_user_write(filp, chunk, len) == (ssize_t)len);
+            model_write(&model, f, chunk, len);
+            model_flatten(&model);
+            break;
+        case FUZZ_READ:
+            fuzz_read(&model, filp, next_byte(&in));
+            break;
+        case FUZZ_LLSEEK:
+            len = next_byte(&in);
+            fuzz_llseek(filp, &model, len % 3, (int8_t)next_byte(&in));
+            break;
+        case FUZZ_SEEKTO:
+            len = next_byte(&in);
+            fuzz_seekto(filp, &model, len % (FUZZ_MAX_CAPACITY + 1), next_byte(&in) % 32);
+            break;
+        case FUZZ_SETCAPACITY:
+            fuzz_setcapacity(&model, f, next_byte(&in) % (FUZZ_MAX_CAPACITY + 1));
+            model_flatten(&model);
+            break;
+        case FUZZ_STATS:
+            fuzz_stats(&model, f);
+            break;
+        case FUZZ_SEARCH:
+            len = 1 + next_byte(&in) % 3;
+            for (size_t i = 0; i < len; i++) {
+                chunk[i] = to_cmd_byte(next_byte(&in));
+            }
+            fuzz_search(&model, filp, chunk, len, 1 + next_byte(&in) % 4);
+            break;
+        case FUZZ_SNAPSHOT:
+            fuzz_snapshot(&model, f);
+            break;
+        default:
+            // The partial command of a closed file is dropped
+            FUZZ_CHECK(aesd_user_close(filp) == 0);
+            model.files[f] = NULL;
+            free(model.pending[f].data);
+            model.pending[f] = (struct fuzz_bytes){ 0 };
+            break;
+        }
+        check_entries(&model);
+    }
+
+    for (unsigned int f = 0; f < FUZZ_FILES; f++) {
+        if (model.files[f]) {
+            FUZZ_CHECK(aesd_user_close(model.files[f]) == 0);
+        }
+        free(model.pending[f].data);
+    }
+    aesd_user_unload();
+    model_evict(&model, 0);
+    free(model.flat);
+    return 0;
+}
+
+#ifndef AESD_LIBFUZZER
+static int run_file(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    uint8_t *data = NULL;
+    size_t size = 0;
+    long len;
+
+    if (!fp || fseek(fp, 0, SEEK_END) || (len = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET)) {
+        perror(path);
+        if (fp) {
+            fclose(fp);
+        }
+        return 1;
+    }
+    data = malloc(len ? len : 1);
+    if (data) {
+        size = fread(data, 1, len, fp);
+    }
+    fclose(fp);
+    if (!data) {
+        return 1;
+    }
+    LLVMFuzzerTestOneInput(data, size);
+    free(data);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t data[FUZZ_DEFAULT_INPUT_SIZE];
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            if (run_file(argv[i])) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    for (unsigned int n = 0; n < FUZZ_DEFAULT_INPUTS; n++) {
+        size_t size = n % FUZZ_DEFAULT_INPUT_SIZE;
+
+        for (size_t i = 0; i < size; i++) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            data[i] = (uint8_t)state;
+        }
+        LLVMFuzzerTestOneInput(data, size);
+    }
+    printf("%u inputs passed\n", FUZZ_DEFAULT_INPUTS);
+    return 0;
+}
+#endif
@@ -0,0 +1,191 @@
+/**
+ * @file    aesdchar-user-bench.c
+ * @brief   Multithreaded throughput benchmark of the aesdchar driver built for userspace.
+ *          For each storage mode and each mix of writer and reader threads, writers append
+ *          fixed size commands through their own file while readers re-read the whole
+ *          device from the start, for a fixed time. Prints one CSV row per case, in a fixed
+ *          order so the outputs of two commits can be diffed. No kernel module, VM or
+ *          root is needed, and the driver code can be profiled with ordinary tools.
+ *
+ *          Usage: aesdchar-user-bench [seconds per case] [max threads]
+ *
+ * @author  Suhas-Reddy-S
+ **/
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "aesdchar-user.h"
+
+#define BENCH_DEFAULT_SECONDS 1.0
+#define BENCH_DEFAULT_MAX_THREADS 4
+#define BENCH_CAPACITY 1024
+#define BENCH_RING_SIZE (1024 * 1024)
+#define BENCH_CMD_SIZE 64
+#define BENCH_READ_SIZE 4096
+
+struct bench_mode {
+    const char *name;
+    unsigned int ring_size;
+};
+
+static const struct bench_mode modes[] = {
+    { "alloc", 0 },
+    { "ring", BENCH_RING_SIZE },
+};
+
+struct bench_thread {
+    pthread_t thread;
+    unsigned long long ops;
+    unsigned long long bytes;
+    int error;
+};
+
+static atomic_bool stop;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *writer_thread(void *arg)
+{
+    struct bench_thread *t = arg;
+    char cmd[BENCH_CMD_SIZE];
+    struct file *filp;
+    ssize_t ret;
+
+    memset(cmd, 'w', sizeof(cmd) - 1);
+    cmd[sizeof(cmd) - 1] = '\n';
+    t->error = aesd_user_open(0, 0, &filp);
+    if (t->error) {
+        return NULL;
+    }
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        ret = aesd_user_write(filp, cmd, sizeof(cmd));
+        if (ret != sizeof(cmd)) {
+            t->error = ret < 0 ? (int)ret : -EIO;
+            break;
+        }
+        t->ops++;
+        t->bytes += ret;
+    }
+    aesd_user_close(filp);
+    return NULL;
+}
+
+static void *reader_thread(void *arg)
+{
+    struct bench_thread *t = arg;
+    char buf[BENCH_READ_SIZE];
+    struct file *filp;
+    ssize_t ret;
+
+    t->error = aesd_user_open(0, 0, &filp);
+    if (t->error) {
+        return NULL;
+    }
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        aesd_user_llseek(filp, 0, SEEK_SET);
+        while ((ret = aesd_user_read(filp, buf, sizeof(buf))) > 0) {
+            t->ops++;
+            t->bytes += ret;
+        }
+        if (ret < 0) {
+            t->error = (int)ret;
+            break;
+        }
+    }
+    aesd_user_close(filp);
+    return NULL;
+}
+
+/**
+ * Runs @param writers writer and @param readers reader threads for @param seconds on a
+ * freshly loaded driver and prints the aggregate rates
+ * @return 0 on success or a negative errno value
+ */
+static int bench_case(const struct bench_mode *mode, unsigned int writers, unsigned int readers,
+        double seconds)
+{
+    struct bench_thread *threads = calloc(writers + readers, sizeof(*threads));
+    unsigned long long wops = 0, wbytes = 0, rops = 0, rbytes = 0;
+    struct timespec duration = { (time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9) };
+    double start, elapsed;
+    unsigned int i;
+    int rc;
+
+    if (!threads) {
+        return -ENOMEM;
+    }
+    *kshim_param_aesd_ring_size = mode->ring_size;
+    rc = aesd_user_load();
+    if (rc) {
+        free(threads);
+        return rc;
+    }
+    atomic_store(&stop, false);
+    start = now_s();
+    for (i = 0; i < writers + readers; i++) {
+        pthread_create(&threads[i].thread, NULL, i < writers ? writer_thread : reader_thread, &threads[i]);
+    }
+    nanosleep(&duration, NULL);
+    atomic_store(&stop, true);
+    for (i = 0; i < writers + readers; i++) {
+        pthread_join(threads[i].thread, NULL);
+        if (threads[i].error && !rc) {
+            rc = threads[i].error;
+        }
+        if (i < writers) {
+            wops += threads[i].ops;
+            wbytes += threads[i].bytes;
+        } else {
+            rops += threads[i].ops;
+            rbytes += threads[i].bytes;
+        }
+    }
+    elapsed = now_s() - start;
+    aesd_user_unload();
+    free(threads);
+    if (rc) {
+        return rc;
+    }
+
+    printf("%s,%u,%u,%u,%.0f,%.1f,%.0f,%.1f\n", mode->name, writers, readers, BENCH_CMD_SIZE,
+            wops / elapsed, wbytes / elapsed / 1e6, rops / elapsed, rbytes / elapsed / 1e6);
+    fflush(stdout);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = argc > 1 ? strtod(argv[1], NULL) : BENCH_DEFAULT_SECONDS;
+    unsigned int max_threads = argc > 2 ? (unsigned int)strtoul(argv[2], NULL, 0) : BENCH_DEFAULT_MAX_THREADS;
+
+    if (seconds <= 0 || max_threads == 0) {
+        fprintf(stderr, "Usage: %s [seconds per case] [max threads]\n", argv[0]);
+        return 1;
+    }
+    *kshim_param_aesd_max_entries = BENCH_CAPACITY;
+
+    printf("mode,writers,readers,cmd_size,write_cmds_per_s,write_mb_per_s,reads_per_s,read_mb_per_s\n");
+    for (size_t m = 0; m < ARRAY_SIZE(modes); m++) {
+        for (unsigned int writers = 1; writers <= max_threads; writers *= 2) {
+            for (unsigned int readers = 0; readers <= max_threads; readers = readers ? readers * 2 : 1) {
+                int rc = bench_case(&modes[m], writers, readers, seconds);
+
+                if (rc) {
+                    fprintf(stderr, "%s, %u writers, %u readers: %s\n", modes[m].name, writers, readers,
+                            strerror(-rc));
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
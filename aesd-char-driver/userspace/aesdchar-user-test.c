@@ -0,0 +1,422 @@
+/**
+ * @file    aesdchar-user-test.c
+ * @brief   Functional test of the aesdchar driver built for userspace. Covers reads and
+ *          writes, partial commands, eviction, seeks, the ioctls, snapshots across a
+ *          reload and concurrent writers and readers, once with commands allocated one by
+ *          one and once in byte ring mode. Every case loads a fresh driver and unloads it,
+ *          so leaks show up under AddressSanitizer.
+ *
+ *          Usage: aesdchar-user-test, exits non zero when a check fails
+ *
+ * @author  Suhas-Reddy-S
+ **/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "aesdchar-user.h"
+#include "../aesd-circular-buffer.h"
+
+#define TEST_RING_SIZE 8192
+#define TEST_WRITERS 4
+#define TEST_READERS 4
+#define TEST_CMDS_PER_WRITER 2000
+#define TEST_BUF_SIZE (1024 * 1024)
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+            return; \
+        } \
+    } while (0)
+
+static int failures;
+static char buf[TEST_BUF_SIZE];
+
+static int write_str(struct file *filp, const char *str)
+{
+    return aesd_user_write(filp, str, strlen(str)) == (ssize_t)strlen(str) ? 0 : -1;
+}
+
+// Reads from the current position to the end in @param chunk byte reads
+static ssize_t read_all(struct file *filp, size_t chunk)
+{
+    size_t total = 0;
+    ssize_t ret;
+
+    while ((ret = aesd_user_read(filp, buf + total, min(chunk, sizeof(buf) - 1 - total))) > 0) {
+        total += ret;
+    }
+    buf[total] = '\0';
+    return ret < 0 ? ret : (ssize_t)total;
+}
+
+static void test_read_write(void)
+{
+    struct file *filp;
+
+    CHECK(aesd_user_open(0, 0, &filp) == 0);
+    CHECK(write_str(filp, "write1\n") == 0);
+    CHECK(write_str(filp, "wri") == 0);
+    CHECK(write_str(filp, "te2\nwrite3\n") == 0);
+    CHECK(aesd_user_llseek(filp, 0, SEEK_SET) == 0);
+    CHECK(read_all(filp, 3) == 21);
+    CHECK(strcmp(buf, "write1\nwrite2\nwrite3\n") == 0);
+    // A partial command is not readable until its newline arrives
+    CHECK(write_str(filp, "write4") == 0);
+    CHECK(aesd_user_llseek(filp, 0, SEEK_END) == 21);
+    CHECK(aesd_user_close(filp) == 0);
+}
+
+static void test_eviction(void)
+{
+    struct file *filp;
+    char cmd[16];
+
+    CHECK(aesd_user_open(0, 0, &filp) == 0);
+    for (int i = 1; i <= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 2; i++) {
+        snprintf(cmd, sizeof(cmd), "cmd%d\n", i);
+        CHECK(write_str(filp, cmd) == 0);
+    }
+    CHECK(aesd_user_llseek(filp, 0, SEEK_SET) == 0);
+    CHECK(read_all(filp, 4096) > 0);
+    CHECK(strncmp(buf, "cmd3\ncmd4\n", 10) == 0);
+    CHECK(strcmp(buf + strlen(buf) - 6, "cmd12\n") == 0);
+    CHECK(aesd_user_close(filp) == 0);
+}
+
+static void test_seek(void)
+{
+    struct aesd_seekto seekto = { .write_cmd = 1, .write_cmd_offset = 2 };
+    struct file *filp;
+
+    CHECK(aesd_user_open(0, 0, &filp) == 0);
+    CHECK(write_str(filp, "zero\none\ntwo\n") == 0);
+    CHECK(aesd_user_ioctl(filp, AESDCHAR_IOCSEEKTO, &seekto) == 0);
+    CHECK(filp->f_pos == 7);
+    CHECK(read_all(filp, 1) == 6);
+    CHECK(strcmp(buf, "e\ntwo\n") == 0);
+    seekto.write_cmd_offset = 5;
+    CHECK(aesd_user_ioctl(filp, AESDCHAR_IOCSEEKTO, &seekto) == -EINVAL);
+    seekto = (struct aesd_seekto){ .write_cmd = 3 };
+    CHECK(aesd_user_ioctl(filp, AESDCHAR_IOCSEEKTO, &seekto) == -EINVAL);
+    CHECK(aesd_user_llseek(filp, -4, SEEK_END) == 9);
+    CHECK(aesd_user_llseek(filp, 1, SEEK_CUR) == 10);
+    CHECK(aesd_user_llseek(filp, -1, SEEK_SET) == -EINVAL);
+    CHECK(aesd_user_close(filp) == 0);
+}
+
+// Partial commands of different files never mix
+// A resize that can't allocate its new buffer drops nothing
+static void test_set_capacity(void)
+{
+    struct file *filp;
+    struct aesd_stats stats;
+
+    CHECK(aesd_user_open(0, 0, &filp) == 0);
+    CHECK(write_str(filp, "one\ntwo\nthree\n") == 0);
+    // The first allocation is the buffer struct, the second its slots
+    kshim_fail_alloc = 2;
+    CHECK(aesd_user_ioctl(filp, AESDCHAR_IOCSETCAPACITY, &(uint32_t){ 2 }) == -ENOMEM);
+    kshim_fail_alloc = 0;
+    CHECK(aesd_user_ioctl(filp, AESDCHAR_IOCGSTATS, &stats) == 0);
+    CHECK(stats.entries == 3 && stats.capacity == AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
+    CHECK(aesd_user_llseek(filp, 0, SEEK_SET) == 0);
+    CHECK(read_all(filp, 4096) == 14);
+    CHECK(strcmp(buf, "one\ntwo\nthree\n") == 0);
+
+    CHECK(aesd_user_ioctl(filp, AESDCHAR_IOCSETCAPACITY, &(uint32_t){ 2 }) == 0);
+    CHECK(aesd_user_ioctl(filp, AESDCHAR_IOCGSTATS, &stats) == 0);
+    CHECK(stats.entries == 2 && stats.capacity == 2);
+    CHECK(aesd_user_llseek(filp, 0, SEEK_SET) == 0);
+    CHECK(read_all(filp, 4096) == 10);
+    CHECK(strcmp(buf, "two\nthree\n") == 0);
+    CHECK(aesd_user_close(filp) == 0);
+}
+
+static void test_pending_per_file(void)
+{
+    struct aesd_stats stats;
+    struct file *a, *b;
+
+    CHECK(aesd_user_open(0, 0, &a) == 0);
+    CHECK(aesd_user_open(0, 0, &b) == 0);
+    CHECK(write_str(a, "aaa") == 0);
+    CHECK(write_str(b, "bbb") == 0);
+    CHECK(write_str(a, "AAA\n") == 0);
+    CHECK(aesd_user_ioctl(b, AESDCHAR_IOCGSTATS, &stats) == 0);
+    CHECK(stats.entries == 1 && stats.pending_bytes == 3);
+    CHECK(write_str(b, "BBB\n") == 0);
+    CHECK(read_all(a, 4096) == 14);
+    CHECK(strcmp(buf, "aaaAAA\nbbbBBB\n") == 0);
+    // Resizing needs the device to itself
+    CHECK(aesd_user_ioctl(a, AESDCHAR_IOCSETCAPACITY, &(uint32_t){ 1 }) == -EBUSY);
+    CHECK(aesd_user_close(b) == 0);
+    CHECK(aesd_user_ioctl(a, AESDCHAR_IOCSETCAPACITY, &(uint32_t){ 1 }) == 0);
+    CHECK(aesd_user_llseek(a, 0, SEEK_SET) == 0);
+    CHECK(read_all(a, 4096) == 7);
+    CHECK(strcmp(buf, "bbbBBB\n") == 0);
+    CHECK(aesd_user_close(a) == 0);
+}
+
+static void test_read_entries_and_search(void)
+{
+    static const char *const cmds[] = { "find me\n", "nothing\n", "me me\n" };
+    struct aesd_read_entries req = { .max_count = 8, .buf = (uintptr_t)buf, .buf_size = sizeof(buf) };
+    struct aesd_search_match matches[8];
+    struct aesd_search search = {
+        .pattern = (uintptr_t)"me", .pattern_len = 2,
+        .max_matches = 8, .matches = (uintptr_t)matches,
+    };
+    const struct aesd_entry_desc *desc = (const void *)buf;
+    struct file *filp;
+
+    CHECK(aesd_user_open(0, 0, &filp) == 0);
+    for (size_t i = 0; i < ARRAY_SIZE(cmds); i++) {
+        CHECK(write_str(filp, cmds[i]) == 0);
+    }
+    CHECK(aesd_user_ioctl(filp, AESDCHAR_IOCREADENTRIES, &req) == 0);
+    CHECK(req.count == 3);
+    for (size_t i = 0; i < ARRAY_SIZE(cmds); i++) {
+        CHECK(desc[i].index == i && desc[i].size == strlen(cmds[i]));
+        CHECK(memcmp(buf + desc[i].data_offset, cmds[i], desc[i].size) == 0);
+    }
+    // Asking for no commands is not a buffer too small
+    req.max_count = 0;
+    CHECK(aesd_user_ioctl(filp, AESDCHAR_IOCREADENTRIES, &req) == 0);
+    CHECK(req.count == 0 && req.bytes == 0);
+    CHECK(aesd_user_ioctl(filp, AESDCHAR_IOCSEARCH, &search) == 0);
+    CHECK(search.done && search.count == 3);
+    CHECK(matches[0].index == 0 && matches[0].offset == 5 && matches[0].fpos == 5);
+    CHECK(matches[1].index == 2 && matches[1].offset == 0 && matches[1].fpos == 16);
+    CHECK(matches[2].index == 2 && matches[2].offset == 3 && matches[2].fpos == 19);
+    CHECK(aesd_user_close(filp) == 0);
+}
+
+// A snapshot taken before a reload restores the commands and the partial command
+static void test_snapshot(void)
+{
+    static char snap[4096];
+    const struct aesd_snapshot_header *hdr = (const void *)snap;
+    const uint64_t *sizes = (const void *)(hdr + 1);
+    struct aesd_snapshot req = { .buf = (uintptr_t)snap };
+    struct aesd_stats stats;
+    struct file *a, *b;
+    uint64_t bytes;
+
+    CHECK(aesd_user_open(0, 0, &a) == 0);
+    CHECK(write_str(a, "one\ntwo\npart") == 0);
+    CHECK(aesd_user_ioctl(a, AESDCHAR_IOCEXPORT, &req) == -ENOSPC);
+    CHECK(req.bytes == sizeof(*hdr) + 3 * sizeof(uint64_t) + 12);
+    req.buf_size = sizeof(snap);
+    CHECK(aesd_user_ioctl(a, AESDCHAR_IOCEXPORT, &req) == 0);
+    CHECK(hdr->magic == AESD_SNAPSHOT_MAGIC && hdr->count == 2 && hdr->bytes == req.bytes);
+    CHECK(sizes[0] == 4 && sizes[1] == 4 && sizes[2] == 4);
+    CHECK(memcmp(sizes + 3, "one\ntwo\npart", 12) == 0);
+    bytes = req.bytes;
+    CHECK(aesd_user_close(a) == 0);
+
+    aesd_user_unload();
+    CHECK(aesd_user_load() == 0);
+    CHECK(aesd_user_open(0, 0, &a) == 0);
+    CHECK(write_str(a, "old\n") == 0);
+    // Rejected snapshots change nothing
+    req.buf_size = bytes - 1;
+    CHECK(aesd_user_ioctl(a, AESDCHAR_IOCIMPORT, &req) == -EINVAL);
+    req.buf_size = bytes;
+    snap[bytes - 2] = '\n';
+    CHECK(aesd_user_ioctl(a, AESDCHAR_IOCIMPORT, &req) == -EINVAL);
+    snap[bytes - 2] = 'r';
+    CHECK(aesd_user_open(0, 0, &b) == 0);
+    CHECK(aesd_user_ioctl(a, AESDCHAR_IOCIMPORT, &req) == -EBUSY);
+    CHECK(aesd_user_close(b) == 0);
+    CHECK(read_all(a, 4096) == 4 && strcmp(buf, "old\n") == 0);
+
+    CHECK(aesd_user_ioctl(a, AESDCHAR_IOCIMPORT, &req) == 0);
+    CHECK(req.bytes == bytes);
+    CHECK(aesd_user_ioctl(a, AESDCHAR_IOCGSTATS, &stats) == 0);
+    CHECK(stats.entries == 2 && stats.bytes == 8 && stats.pending_bytes == 4);
+    CHECK(write_str(a, "ial\n") == 0);
+    CHECK(aesd_user_llseek(a, 0, SEEK_SET) == 0);
+    CHECK(read_all(a, 4096) == 16);
+    CHECK(strcmp(buf, "one\ntwo\npartial\n") == 0);
+    // A pending command of the importing file would be lost
+    CHECK(write_str(a, "x") == 0);
+    CHECK(aesd_user_ioctl(a, AESDCHAR_IOCIMPORT, &req) == -EBUSY);
+    CHECK(aesd_user_close(a) == 0);
+}
+
+static void *tail_reader(void *arg)
+{
+    static char tail_buf[64];
+    struct file *filp = arg;
+    ssize_t ret = aesd_user_read(filp, tail_buf, sizeof(tail_buf) - 1);
+
+    return ret == 5 && memcmp(tail_buf, "tail\n", 5) == 0 ? filp : NULL;
+}
+
+// A tail mode read at the end sleeps until the next command is written
+static void test_tail_wait(void)
+{
+    struct file *reader, *writer;
+    pthread_t thread;
+    void *result;
+
+    CHECK(aesd_user_open(0, 0, &reader) == 0);
+    CHECK(aesd_user_open(0, 0, &writer) == 0);
+    CHECK(aesd_user_ioctl(reader, AESDCHAR_IOCSETTAIL, &(uint32_t){ 1 }) == 0);
+    CHECK(pthread_create(&thread, NULL, tail_reader, reader) == 0);
+    CHECK(write_str(writer, "tail\n") == 0);
+    pthread_join(thread, &result);
+    CHECK(result == reader);
+    // A sleeping tail reader doesn't hold up a seek of its file, and reads from the new position
+    CHECK(pthread_create(&thread, NULL, tail_reader, reader) == 0);
+    usleep(10000);
+    CHECK(aesd_user_ioctl(reader, AESDCHAR_IOCSEEKTO, &(struct aesd_seekto){ 0, 0 }) == 0);
+    pthread_join(thread, &result);
+    CHECK(result == reader);
+    CHECK(aesd_user_close(writer) == 0);
+    CHECK(aesd_user_close(reader) == 0);
+}
+
+struct worker {
+    pthread_t thread;
+    unsigned int id;
+    volatile bool *stop;
+    bool ok;
+};
+
+static void *concurrent_writer(void *arg)
+{
+    struct worker *w = arg;
+    struct file *filp;
+    char cmd[32];
+
+    w->ok = aesd_user_open(0, 0, &filp) == 0;
+    for (unsigned int seq = 0; w->ok && seq < TEST_CMDS_PER_WRITER; seq++) {
+        int len = snprintf(cmd, sizeof(cmd), "w%u %u\n", w->id, seq);
+        // Two writes per command exercise the per file pending command
+        w->ok = aesd_user_write(filp, cmd, 2) == 2
+                && aesd_user_write(filp, cmd + 2, len - 2) == len - 2;
+    }
+    if (w->ok) {
+        w->ok = aesd_user_close(filp) == 0;
+    }
+    return NULL;
+}
+
+/*
+ * Eviction between two reads may cut lines, but a byte outside the alphabet of the
+ * commands means a reader saw freed or half written memory
+ */
+static void *concurrent_reader(void *arg)
+{
+    struct worker *w = arg;
+    char *rbuf = malloc(TEST_BUF_SIZE);
+    struct file *filp;
+    ssize_t ret = 0;
+
+    w->ok = rbuf && aesd_user_open(0, 0, &filp) == 0;
+    while (w->ok && !*w->stop) {
+        w->ok = aesd_user_llseek(filp, 0, SEEK_SET) == 0;
+        while (w->ok && (ret = aesd_user_read(filp, rbuf, 4096)) > 0) {
+            w->ok = strspn(rbuf, "w 0123456789\n") >= (size_t)ret;
+        }
+        w->ok = w->ok && ret == 0;
+    }
+    if (rbuf && w->ok) {
+        w->ok = aesd_user_close(filp) == 0;
+    }
+    free(rbuf);
+    return NULL;
+}
+
+/*
+ * Writers and readers race on one device.  Afterwards the commands of each writer must
+ * be whole, in order and consecutive.
+ */
+static void test_concurrent(void)
+{
+    struct worker writers[TEST_WRITERS], readers[TEST_READERS];
+    unsigned int next[TEST_WRITERS] = { 0 };
+    volatile bool stop = false;
+    struct file *filp;
+    ssize_t len;
+
+    for (unsigned int i = 0; i < TEST_READERS; i++) {
+        readers[i] = (struct worker){ .id = i, .stop = &stop };
+        CHECK(pthread_create(&readers[i].thread, NULL, concurrent_reader, &readers[i]) == 0);
+    }
+    for (unsigned int i = 0; i < TEST_WRITERS; i++) {
+        writers[i] = (struct worker){ .id = i, .stop = &stop };
+        CHECK(pthread_create(&writers[i].thread, NULL, concurrent_writer, &writers[i]) == 0);
+    }
+    for (unsigned int i = 0; i < TEST_WRITERS; i++) {
+        pthread_join(writers[i].thread, NULL);
+    }
+    __atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+    for (unsigned int i = 0; i < TEST_READERS; i++) {
+        pthread_join(readers[i].thread, NULL);
+        CHECK(readers[i].ok);
+    }
+    for (unsigned int i = 0; i < TEST_WRITERS; i++) {
+        CHECK(writers[i].ok);
+    }
+
+    CHECK(aesd_user_open(0, 0, &filp) == 0);
+    len = read_all(filp, 4096);
+    CHECK(aesd_user_close(filp) == 0);
+    CHECK(len > 0);
+    for (char *line = buf; *line; line = strchr(line, '\n') + 1) {
+        unsigned int id, seq;
+
+        CHECK(sscanf(line, "w%u %u\n", &id, &seq) == 2 && id < TEST_WRITERS);
+        CHECK(next[id] == 0 || seq == next[id]);
+        next[id] = seq + 1;
+    }
+    // In ring mode the last commands of a writer that finished early may be evicted
+    for (unsigned int i = 0; i < TEST_WRITERS && !*kshim_param_aesd_ring_size; i++) {
+        CHECK(next[i] == TEST_CMDS_PER_WRITER);
+    }
+}
+
+static void run(const char *name, void (*test)(void))
+{
+    int before = failures;
+    int rc = aesd_user_load();
+
+    if (rc) {
+        fprintf(stderr, "%s: load failed: %d\n", name, rc);
+        failures++;
+        return;
+    }
+    test();
+    aesd_user_unload();
+    printf("%-32s %s (ring size %u)\n", name, failures == before ? "ok" : "FAILED",
+            *kshim_param_aesd_ring_size);
+}
+
+int main(void)
+{
+    static const unsigned int ring_sizes[] = { 0, TEST_RING_SIZE };
+
+    for (size_t i = 0; i < ARRAY_SIZE(ring_sizes); i++) {
+        *kshim_param_aesd_ring_size = ring_sizes[i];
+        *kshim_param_aesd_max_entries = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        run("read_write", test_read_write);
+        run("eviction", test_eviction);
+        run("seek", test_seek);
+        run("set_capacity", test_set_capacity);
+        run("pending_per_file", test_pending_per_file);
+        run("read_entries_and_search", test_read_entries_and_search);
+        run("snapshot", test_snapshot);
+        run("tail_wait", test_tail_wait);
+        // Room for everything, except in ring mode where bytes run out first
+        *kshim_param_aesd_max_entries = TEST_WRITERS * TEST_CMDS_PER_WRITER;
+        run("concurrent", test_concurrent);
+    }
+    return failures ? 1 : 0;
+}
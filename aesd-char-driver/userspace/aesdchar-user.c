@@ -0,0 +1,117 @@
+/**
+ * @file    aesdchar-user.c
+ * @brief   System call stand-ins of the userspace aesdchar build, see aesdchar-user.h.
+ *          Like the VFS, read and write go through a kiocb positioned at f_pos and store
+ *          the position back, and every file carries the inode it was opened through.
+ *
+ * @author  Suhas-Reddy-S
+ **/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include "aesdchar-user.h"
+#include "../aesdchar.h"
+
+extern struct file_operations aesd_fops;
+extern struct aesd_dev *aesd_devices;
+int aesd_init_module(void);
+void aesd_cleanup_module(void);
+
+struct aesd_user_file {
+    struct file filp;
+    struct inode inode;
+};
+
+unsigned int kshim_fail_alloc;
+
+int kshim_printk(const char *fmt, ...)
+{
+    va_list ap;
+    int ret;
+
+    va_start(ap, fmt);
+    ret = vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    return ret;
+}
+
+int aesd_user_load(void)
+{
+    return aesd_init_module();
+}
+
+void aesd_user_unload(void)
+{
+    aesd_cleanup_module();
+}
+
+int aesd_user_open(unsigned int index, unsigned int flags, struct file **filpp)
+{
+    struct aesd_user_file *ufile;
+    int rc;
+
+    if (index >= *kshim_param_aesd_nr_devs) {
+        return -ENODEV;
+    }
+    ufile = calloc(1, sizeof(*ufile));
+    if (!ufile) {
+        return -ENOMEM;
+    }
+    ufile->inode.i_cdev = &aesd_devices[index].cdev;
+    ufile->filp.f_flags = flags;
+    rc = aesd_fops.open(&ufile->inode, &ufile->filp);
+    if (rc) {
+        free(ufile);
+        return rc;
+    }
+    *filpp = &ufile->filp;
+    return 0;
+}
+
+int aesd_user_close(struct file *filp)
+{
+    struct aesd_user_file *ufile = container_of(filp, struct aesd_user_file, filp);
+    int rc = aesd_fops.release(&ufile->inode, filp);
+
+    free(ufile);
+    return rc;
+}
+
+ssize_t aesd_user_read(struct file *filp, void *buf, size_t count)
+{
+    struct kiocb iocb = { .ki_filp = filp, .ki_pos = filp->f_pos };
+    struct iov_iter iter = { .buf = buf, .count = count };
+    ssize_t ret = aesd_fops.read_iter(&iocb, &iter);
+
+    if (ret >= 0) {
+        filp->f_pos = iocb.ki_pos;
+    }
+    return ret;
+}
+
+ssize_t aesd_user_write(struct file *filp, const void *buf, size_t count)
+{
+    struct kiocb iocb = { .ki_filp = filp, .ki_pos = filp->f_pos };
+    struct iov_iter iter = { .buf = (char *)buf, .count = count };
+    ssize_t ret = aesd_fops.write_iter(&iocb, &iter);
+
+    if (ret >= 0) {
+        filp->f_pos = iocb.ki_pos;
+    }
+    return ret;
+}
+
+loff_t aesd_user_llseek(struct file *filp, loff_t off, int whence)
+{
+    return aesd_fops.llseek(filp, off, whence);
+}
+
+long aesd_user_ioctl(struct file *filp, unsigned int cmd, void *arg)
+{
+    return aesd_fops.unlocked_ioctl(filp, cmd, (unsigned long)arg);
+}
+
+unsigned int aesd_user_poll(struct file *filp)
+{
+    return aesd_fops.poll(filp, NULL);
+}
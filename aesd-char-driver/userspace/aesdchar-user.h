@@ -0,0 +1,54 @@
+/**
+ * @file    aesdchar-user.h
+ * @brief   Userspace build of the aesdchar driver. main.c and aesd-circular-buffer.c are
+ *          compiled unchanged against kshim.h into libaesdchar-user, and the functions
+ *          below stand in for the system calls: each one drives aesd_fops the way the VFS
+ *          would, so tests, benchmarks and fuzzers exercise the real driver code from
+ *          ordinary threads.
+ *
+ *          Set the module parameters through kshim_param_<name> before aesd_user_load().
+ *          Functions return 0 or a count on success and a negative errno value on failure,
+ *          like the driver itself.
+ *
+ * @author  Suhas-Reddy-S
+ **/
+
+#ifndef AESD_CHAR_DRIVER_USERSPACE_AESDCHAR_USER_H_
+#define AESD_CHAR_DRIVER_USERSPACE_AESDCHAR_USER_H_
+
+#include "kshim.h"
+#include "../aesd_ioctl.h"
+
+/* Module parameters of main.c */
+extern unsigned int *const kshim_param_aesd_nr_devs;
+extern unsigned int *const kshim_param_aesd_max_entries;
+extern unsigned int *const kshim_param_aesd_mmap_size;
+extern unsigned int *const kshim_param_aesd_ring_size;
+extern unsigned long *const kshim_param_aesd_max_bytes;
+
+/**
+ * Loads the driver: runs its module init with the current parameters
+ */
+int aesd_user_load(void);
+
+/**
+ * Unloads the driver, every file must be closed first
+ */
+void aesd_user_unload(void);
+
+/**
+ * Opens device @param index (0 to aesd_nr_devs - 1) with open flags @param flags, only
+ * O_NONBLOCK matters to the driver
+ */
+int aesd_user_open(unsigned int index, unsigned int flags, struct file **filpp);
+int aesd_user_close(struct file *filp);
+ssize_t aesd_user_read(struct file *filp, void *buf, size_t count);
+ssize_t aesd_user_write(struct file *filp, const void *buf, size_t count);
+loff_t aesd_user_llseek(struct file *filp, loff_t off, int whence);
+long aesd_user_ioctl(struct file *filp, unsigned int cmd, void *arg);
+/**
+ * @return the poll mask of @param filp
+ */
+unsigned int aesd_user_poll(struct file *filp);
+
+#endif /* AESD_CHAR_DRIVER_USERSPACE_AESDCHAR_USER_H_ */
@@ -0,0 +1,2 @@
+/* Userspace build of the aesdchar driver: the _IO* macros of the uapi headers */
+#include_next <asm-generic/ioctl.h>
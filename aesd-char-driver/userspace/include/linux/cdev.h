@@ -0,0 +1,2 @@
+/* Userspace build of the aesdchar driver, see kshim.h */
+#include "../../kshim.h"
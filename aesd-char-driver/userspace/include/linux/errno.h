@@ -0,0 +1,2 @@
+/* Userspace build of the aesdchar driver: libc reaches the errno values through here */
+#include <asm/errno.h>
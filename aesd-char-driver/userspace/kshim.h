@@ -0,0 +1,845 @@
+/*
+ * kshim.h
+ *
+ * Userspace stand-ins for the kernel APIs used by the aesdchar driver, so that main.c and
+ * aesd-circular-buffer.c build unchanged into a userspace library for tests, benchmarks
+ * and fuzzing.  Build with -D__KERNEL__ -I<this directory>/include: every <linux/...>
+ * include of the driver then lands here.
+ *
+ * Everything the driver relies on for concurrency is real: mutexes, seqcounts, SRCU with
+ * deferred callbacks, wait queues and atomics are built on pthreads and the compiler's
+ * atomic builtins, so the driver can be hammered from several threads.  The device model,
+ * debugfs, tracepoints and module glue do nothing.  User pointers are plain pointers.
+ */
+
+#ifndef AESD_CHAR_DRIVER_USERSPACE_KSHIM_H_
+#define AESD_CHAR_DRIVER_USERSPACE_KSHIM_H_
+
+/* No stdio.h or fcntl.h: main.c defines SEEK_* itself */
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+/*
+ * No stdint.h either: as in the kernel, uint64_t is u64 and so unsigned long long on
+ * every target, which keeps min() of a size_t and a uint64_t a type error here too
+ */
+typedef unsigned char u8;
+typedef unsigned short u16;
+typedef unsigned int u32;
+typedef unsigned long long u64;
+typedef long long s64;
+typedef u8 uint8_t;
+typedef u16 uint16_t;
+typedef u32 uint32_t;
+typedef u64 uint64_t;
+typedef unsigned long uintptr_t;
+#define SIZE_MAX __SIZE_MAX__
+typedef unsigned int __poll_t;
+typedef unsigned int gfp_t;
+
+/* Annotations and compiler helpers */
+#define __user
+#define __rcu
+#define __percpu
+#define __init
+#define __exit
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+#define BUILD_BUG_ON(cond) _Static_assert(!(cond), #cond)
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+/*
+ * Like the kernel's, min() and max() refuse operands of different types: comparing
+ * pointers to them warns, which -Werror turns into the error the module build reports
+ */
+#define min(a, b) ({ __typeof__(a) _a = (a); __typeof__(b) _b = (b); \
+	(void)(&_a == &_b); _a < _b ? _a : _b; })
+#define max(a, b) ({ __typeof__(a) _a = (a); __typeof__(b) _b = (b); \
+	(void)(&_a == &_b); _a > _b ? _a : _b; })
+#define min3(a, b, c) min(min(a, b), c)
+#define max3(a, b, c) max(max(a, b), c)
+#define min_t(type, a, b) min((type)(a), (type)(b))
+#define max_t(type, a, b) max((type)(a), (type)(b))
+#define LINUX_VERSION_CODE KERNEL_VERSION(6, 6, 0)
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + (c))
+
+/* Module glue.  Parameters are reachable as kshim_param_<name>, set them before init. */
+struct module;
+#define THIS_MODULE ((struct module *)NULL)
+#define MODULE_AUTHOR(author) _Static_assert(1, author)
+#define MODULE_LICENSE(license) _Static_assert(1, license)
+#define MODULE_PARM_DESC(name, desc) _Static_assert(1, desc)
+#define module_param(name, type, perm) __typeof__(name) *const kshim_param_##name = &name
+#define module_init(fn) _Static_assert(1, #fn)
+#define module_exit(fn) _Static_assert(1, #fn)
+
+/* Logging to stderr, pr_debug() stays silent like a disabled dynamic debug site */
+#define KERN_ERR ""
+#define KERN_WARNING ""
+#define KERN_INFO ""
+#define KERN_DEBUG ""
+__attribute__((format(printf, 1, 2))) int kshim_printk(const char *fmt, ...);
+int snprintf(char *str, size_t size, const char *fmt, ...);
+#define printk(...) kshim_printk(__VA_ARGS__)
+#define pr_err(...) kshim_printk(__VA_ARGS__)
+#define pr_warn(...) kshim_printk(__VA_ARGS__)
+#define pr_info(...) kshim_printk(__VA_ARGS__)
+#define pr_debug(...) do { } while (0)
+
+/* Errors */
+#define ERESTARTSYS 512
+#define MAX_ERRNO 4095
+
+static inline void *ERR_PTR(long error)
+{
+	return (void *)error;
+}
+
+static inline long PTR_ERR(const void *ptr)
+{
+	return (long)ptr;
+}
+
+static inline bool IS_ERR(const void *ptr)
+{
+	return (unsigned long)ptr >= (unsigned long)-MAX_ERRNO;
+}
+
+/* Memory ordering and atomics */
+#define READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define WRITE_ONCE(x, val) __atomic_store_n(&(x), (val), __ATOMIC_RELAXED)
+#define smp_rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define smp_mb() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+typedef struct {
+	int counter;
+} atomic_t;
+
+static inline int atomic_read(const atomic_t *v)
+{
+	return __atomic_load_n(&v->counter, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_set(atomic_t *v, int i)
+{
+	__atomic_store_n(&v->counter, i, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_inc(atomic_t *v)
+{
+	__atomic_fetch_add(&v->counter, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_dec(atomic_t *v)
+{
+	__atomic_fetch_sub(&v->counter, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline void cond_resched(void)
+{
+}
+
+/* Allocation */
+#define GFP_KERNEL 0u
+#define GFP_NOWAIT 1u
+#define __GFP_NOWARN 0u
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+
+/*
+ * Fault injection for tests: when set to n > 0, the nth kmalloc family allocation from
+ * now on fails.  Not meant to be changed while other threads allocate.
+ */
+extern unsigned int kshim_fail_alloc;
+
+static inline bool kshim_alloc_fails(void)
+{
+	return kshim_fail_alloc && --kshim_fail_alloc == 0;
+}
+
+static inline void *kmalloc(size_t size, gfp_t flags)
+{
+	(void)flags;
+	return kshim_alloc_fails() ? NULL : malloc(size);
+}
+
+static inline void *kzalloc(size_t size, gfp_t flags)
+{
+	(void)flags;
+	return kshim_alloc_fails() ? NULL : calloc(1, size);
+}
+
+static inline void *kcalloc(size_t n, size_t size, gfp_t flags)
+{
+	(void)flags;
+	return kshim_alloc_fails() ? NULL : calloc(n, size);
+}
+
+static inline void *kmalloc_array(size_t n, size_t size, gfp_t flags)
+{
+	(void)flags;
+	if ((size && n > SIZE_MAX / size) || kshim_alloc_fails()) {
+		return NULL;
+	}
+	return malloc(n * size);
+}
+
+static inline void *krealloc(const void *ptr, size_t size, gfp_t flags)
+{
+	(void)flags;
+	return kshim_alloc_fails() ? NULL : realloc((void *)ptr, size);
+}
+
+static inline void *kmemdup(const void *src, size_t size, gfp_t flags)
+{
+	void *dst = kmalloc(size, flags);
+	if (dst) {
+		memcpy(dst, src, size);
+	}
+	return dst;
+}
+
+static inline void kfree(const void *ptr)
+{
+	free((void *)ptr);
+}
+
+#define kvmalloc kmalloc
+#define kvmalloc_array kmalloc_array
+#define kvfree kfree
+
+static inline void *vmalloc_user(size_t size)
+{
+	void *ptr = aligned_alloc(PAGE_SIZE, (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+	if (ptr) {
+		memset(ptr, 0, size);
+	}
+	return ptr;
+}
+
+static inline void vfree(const void *ptr)
+{
+	free((void *)ptr);
+}
+
+struct kmem_cache {
+	size_t size;
+};
+
+static inline struct kmem_cache *kmem_cache_create(const char *name, unsigned int size,
+		unsigned int align, unsigned long flags, void (*ctor)(void *))
+{
+	struct kmem_cache *cache = malloc(sizeof(*cache));
+	(void)name;
+	(void)align;
+	(void)flags;
+	(void)ctor;
+	if (cache) {
+		cache->size = size;
+	}
+	return cache;
+}
+
+static inline void kmem_cache_destroy(struct kmem_cache *cache)
+{
+	free(cache);
+}
+
+static inline void *kmem_cache_alloc(struct kmem_cache *cache, gfp_t flags)
+{
+	(void)flags;
+	return kshim_alloc_fails() ? NULL : malloc(cache->size);
+}
+
+static inline void kmem_cache_free(struct kmem_cache *cache, void *ptr)
+{
+	(void)cache;
+	free(ptr);
+}
+
+static inline unsigned long roundup_pow_of_two(unsigned long n)
+{
+	unsigned long r = 1;
+	while (r < n) {
+		r <<= 1;
+	}
+	return r;
+}
+
+static inline bool is_power_of_2(unsigned long n)
+{
+	return n != 0 && (n & (n - 1)) == 0;
+}
+
+/* User copies: the "user" buffers of the shim are ordinary memory, empty ones may be NULL */
+static inline unsigned long copy_to_user(void *to, const void *from, unsigned long n)
+{
+	if (n) {
+		memcpy(to, from, n);
+	}
+	return 0;
+}
+
+static inline unsigned long copy_from_user(void *to, const void *from, unsigned long n)
+{
+	if (n) {
+		memcpy(to, from, n);
+	}
+	return 0;
+}
+
+static inline void *memdup_user(const void *src, size_t len)
+{
+	void *dst = kmemdup(src, len, GFP_KERNEL);
+	return dst ? dst : ERR_PTR(-ENOMEM);
+}
+
+#define vmemdup_user memdup_user
+
+/* Mutexes */
+struct mutex {
+	pthread_mutex_t m;
+};
+
+static inline void mutex_init(struct mutex *lock)
+{
+	pthread_mutex_init(&lock->m, NULL);
+}
+
+static inline void mutex_destroy(struct mutex *lock)
+{
+	pthread_mutex_destroy(&lock->m);
+}
+
+static inline void mutex_lock(struct mutex *lock)
+{
+	pthread_mutex_lock(&lock->m);
+}
+
+static inline int mutex_lock_interruptible(struct mutex *lock)
+{
+	pthread_mutex_lock(&lock->m);
+	return 0;
+}
+
+static inline int mutex_trylock(struct mutex *lock)
+{
+	return pthread_mutex_trylock(&lock->m) == 0;
+}
+
+static inline void mutex_unlock(struct mutex *lock)
+{
+	pthread_mutex_unlock(&lock->m);
+}
+
+#define lockdep_is_held(lock) 1
+
+/* Sequence counts, writers are serialized by the associated mutex */
+typedef struct {
+	unsigned int sequence;
+} seqcount_mutex_t;
+
+#define seqcount_mutex_init(s, lock) ((void)(lock), (s)->sequence = 0)
+
+static inline unsigned int read_seqcount_begin(const seqcount_mutex_t *s)
+{
+	unsigned int seq;
+
+	while ((seq = __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE)) & 1) {
+		sched_yield();
+	}
+	return seq;
+}
+
+static inline int read_seqcount_retry(const seqcount_mutex_t *s, unsigned int start)
+{
+	smp_rmb();
+	return __atomic_load_n(&s->sequence, __ATOMIC_RELAXED) != start;
+}
+
+static inline void write_seqcount_begin(seqcount_mutex_t *s)
+{
+	__atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELAXED);
+	smp_wmb();
+}
+
+static inline void write_seqcount_end(seqcount_mutex_t *s)
+{
+	smp_wmb();
+	__atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELAXED);
+}
+
+/* RCU pointers */
+#define srcu_dereference(p, ssp) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define rcu_dereference_protected(p, cond) (p)
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#define RCU_INIT_POINTER(p, v) ((p) = (v))
+
+struct rcu_head {
+	struct rcu_head *next;
+	void (*func)(struct rcu_head *head);
+};
+
+/*
+ * SRCU with two reader counters flipped by every grace period, like the kernel's.
+ * Callbacks queued by call_srcu() are run by a reclaimer thread after a grace period,
+ * since the driver queues them while readers may be spinning on its seqcount.
+ */
+struct srcu_struct {
+	unsigned long idx;
+	long readers[2];
+	pthread_mutex_t gp_lock;	/* serializes grace periods */
+	pthread_mutex_t cb_lock;	/* protects the fields below */
+	pthread_cond_t cb_cond;
+	struct rcu_head *cbs;	/* queued callbacks, newest first */
+	unsigned long queued, invoked;
+	bool stop;
+	pthread_t reclaimer;
+};
+
+static inline int srcu_read_lock(struct srcu_struct *ssp)
+{
+	int idx = __atomic_load_n(&ssp->idx, __ATOMIC_RELAXED) & 1;
+
+	__atomic_fetch_add(&ssp->readers[idx], 1, __ATOMIC_SEQ_CST);
+	smp_mb();
+	return idx;
+}
+
+static inline void srcu_read_unlock(struct srcu_struct *ssp, int idx)
+{
+	smp_mb();
+	__atomic_fetch_sub(&ssp->readers[idx], 1, __ATOMIC_SEQ_CST);
+}
+
+static inline void synchronize_srcu(struct srcu_struct *ssp)
+{
+	pthread_mutex_lock(&ssp->gp_lock);
+	// Two flips: a reader may have sampled idx just before the first one
+	for (int flip = 0; flip < 2; flip++) {
+		unsigned long old = __atomic_fetch_add(&ssp->idx, 1, __ATOMIC_SEQ_CST) & 1;
+		while (__atomic_load_n(&ssp->readers[old], __ATOMIC_SEQ_CST)) {
+			sched_yield();
+		}
+	}
+	pthread_mutex_unlock(&ssp->gp_lock);
+}
+
+static inline void *kshim_srcu_reclaimer(void *arg)
+{
+	struct srcu_struct *ssp = arg;
+	struct rcu_head *head, *next;
+	unsigned long n;
+
+	pthread_mutex_lock(&ssp->cb_lock);
+	for (;;) {
+		while (!ssp->cbs && !ssp->stop) {
+			pthread_cond_wait(&ssp->cb_cond, &ssp->cb_lock);
+		}
+		if (!ssp->cbs) {
+			break;
+		}
+		head = ssp->cbs;
+		ssp->cbs = NULL;
+		pthread_mutex_unlock(&ssp->cb_lock);
+
+		synchronize_srcu(ssp);
+		for (n = 0; head; head = next, n++) {
+			next = head->next;
+			head->func(head);
+		}
+
+		pthread_mutex_lock(&ssp->cb_lock);
+		ssp->invoked += n;
+		pthread_cond_broadcast(&ssp->cb_cond);
+	}
+	pthread_mutex_unlock(&ssp->cb_lock);
+	return NULL;
+}
+
+static inline int init_srcu_struct(struct srcu_struct *ssp)
+{
+	memset(ssp, 0, sizeof(*ssp));
+	pthread_mutex_init(&ssp->gp_lock, NULL);
+	pthread_mutex_init(&ssp->cb_lock, NULL);
+	pthread_cond_init(&ssp->cb_cond, NULL);
+	if (pthread_create(&ssp->reclaimer, NULL, kshim_srcu_reclaimer, ssp)) {
+		pthread_cond_destroy(&ssp->cb_cond);
+		pthread_mutex_destroy(&ssp->cb_lock);
+		pthread_mutex_destroy(&ssp->gp_lock);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static inline void call_srcu(struct srcu_struct *ssp, struct rcu_head *head,
+		void (*func)(struct rcu_head *head))
+{
+	head->func = func;
+	pthread_mutex_lock(&ssp->cb_lock);
+	head->next = ssp->cbs;
+	ssp->cbs = head;
+	ssp->queued++;
+	pthread_cond_broadcast(&ssp->cb_cond);
+	pthread_mutex_unlock(&ssp->cb_lock);
+}
+
+static inline void srcu_barrier(struct srcu_struct *ssp)
+{
+	pthread_mutex_lock(&ssp->cb_lock);
+	unsigned long target = ssp->queued;
+	while (ssp->invoked < target) {
+		pthread_cond_wait(&ssp->cb_cond, &ssp->cb_lock);
+	}
+	pthread_mutex_unlock(&ssp->cb_lock);
+}
+
+static inline void cleanup_srcu_struct(struct srcu_struct *ssp)
+{
+	pthread_mutex_lock(&ssp->cb_lock);
+	ssp->stop = true;
+	pthread_cond_broadcast(&ssp->cb_cond);
+	pthread_mutex_unlock(&ssp->cb_lock);
+	pthread_join(ssp->reclaimer, NULL);
+	pthread_cond_destroy(&ssp->cb_cond);
+	pthread_mutex_destroy(&ssp->cb_lock);
+	pthread_mutex_destroy(&ssp->gp_lock);
+}
+
+/*
+ * Wait queues.  Waiters sample an event count before testing their condition, so the
+ * condition is never evaluated under the queue lock and a wake up between the test and
+ * the wait is not lost.
+ */
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned long events;
+} wait_queue_head_t;
+
+static inline void init_waitqueue_head(wait_queue_head_t *wq)
+{
+	pthread_mutex_init(&wq->lock, NULL);
+	pthread_cond_init(&wq->cond, NULL);
+	wq->events = 0;
+}
+
+static inline void kshim_wake_up(wait_queue_head_t *wq)
+{
+	pthread_mutex_lock(&wq->lock);
+	wq->events++;
+	pthread_cond_broadcast(&wq->cond);
+	pthread_mutex_unlock(&wq->lock);
+}
+
+static inline void kshim_wait_events(wait_queue_head_t *wq, unsigned long events)
+{
+	pthread_mutex_lock(&wq->lock);
+	while (wq->events == events) {
+		pthread_cond_wait(&wq->cond, &wq->lock);
+	}
+	pthread_mutex_unlock(&wq->lock);
+}
+
+#define wake_up_interruptible(wq) kshim_wake_up(wq)
+#define wake_up_interruptible_poll(wq, mask) kshim_wake_up(wq)
+#define wait_event_interruptible(wq, condition) ({ \
+	for (;;) { \
+		unsigned long __events = __atomic_load_n(&(wq).events, __ATOMIC_ACQUIRE); \
+		if (condition) { \
+			break; \
+		} \
+		kshim_wait_events(&(wq), __events); \
+	} \
+	0; \
+})
+
+/* Polling and file flags */
+typedef struct poll_table_struct poll_table;
+#define poll_wait(filp, wq, pt) ((void)(filp), (void)(wq), (void)(pt))
+#define EPOLLIN ((__poll_t)0x0001)
+#define EPOLLOUT ((__poll_t)0x0004)
+#define EPOLLRDNORM ((__poll_t)0x0040)
+#define EPOLLWRNORM ((__poll_t)0x0100)
+#define O_NONBLOCK 04000
+
+/* Per CPU data, a single copy updated atomically from every thread */
+#define alloc_percpu(type) ((type *)calloc(1, sizeof(type)))
+#define free_percpu(ptr) free(ptr)
+#define per_cpu_ptr(ptr, cpu) ((void)(cpu), (ptr))
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < 1; (cpu)++)
+#define this_cpu_add(var, n) ((void)__atomic_fetch_add(&(var), (n), __ATOMIC_RELAXED))
+#define this_cpu_inc(var) this_cpu_add(var, 1)
+
+static inline u64 ktime_get_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Files, iterators and character devices */
+#define MINORBITS 20
+#define MKDEV(ma, mi) (((dev_t)(ma) << MINORBITS) | (mi))
+#define MAJOR(dev) ((unsigned int)((dev) >> MINORBITS))
+#define MINOR(dev) ((unsigned int)((dev) & ((1U << MINORBITS) - 1)))
+#define IOCB_NOWAIT (1 << 7)
+
+struct cdev {
+	const struct file_operations *ops;
+	struct module *owner;
+	dev_t dev;
+};
+
+struct inode {
+	struct cdev *i_cdev;
+};
+
+struct file {
+	void *private_data;
+	loff_t f_pos;
+	unsigned int f_flags;
+};
+
+struct kiocb {
+	struct file *ki_filp;
+	loff_t ki_pos;
+	int ki_flags;
+};
+
+/* A single user buffer */
+struct iov_iter {
+	char *buf;
+	size_t count;
+};
+
+static inline size_t iov_iter_count(const struct iov_iter *i)
+{
+	return i->count;
+}
+
+static inline size_t copy_to_iter(const void *addr, size_t bytes, struct iov_iter *i)
+{
+	bytes = min(bytes, i->count);
+	if (bytes) {
+		memcpy(i->buf, addr, bytes);
+	}
+	i->buf += bytes;
+	i->count -= bytes;
+	return bytes;
+}
+
+static inline size_t copy_from_iter(void *addr, size_t bytes, struct iov_iter *i)
+{
+	bytes = min(bytes, i->count);
+	if (bytes) {
+		memcpy(addr, i->buf, bytes);
+	}
+	i->buf += bytes;
+	i->count -= bytes;
+	return bytes;
+}
+
+static inline void iov_iter_revert(struct iov_iter *i, size_t unroll)
+{
+	i->buf -= unroll;
+	i->count += unroll;
+}
+
+struct vm_area_struct {
+	unsigned long vm_flags;
+	unsigned long vm_pgoff;
+};
+
+#define VM_WRITE 0x00000002UL
+#define VM_MAYWRITE 0x00000020UL
+#define vm_flags_clear(vma, flags) ((vma)->vm_flags &= ~(flags))
+
+static inline int remap_vmalloc_range(struct vm_area_struct *vma, void *addr, unsigned long pgoff)
+{
+	(void)vma;
+	(void)addr;
+	(void)pgoff;
+	return 0;
+}
+
+struct file_operations {
+	struct module *owner;
+	ssize_t (*read_iter)(struct kiocb *iocb, struct iov_iter *to);
+	ssize_t (*write_iter)(struct kiocb *iocb, struct iov_iter *from);
+	const void *splice_read;
+	const void *splice_write;
+	int (*open)(struct inode *inode, struct file *filp);
+	int (*release)(struct inode *inode, struct file *filp);
+	loff_t (*llseek)(struct file *filp, loff_t off, int whence);
+	long (*unlocked_ioctl)(struct file *filp, unsigned int cmd, unsigned long arg);
+	__poll_t (*poll)(struct file *filp, poll_table *wait);
+	int (*mmap)(struct file *filp, struct vm_area_struct *vma);
+};
+
+/* Splicing is not modelled */
+#define copy_splice_read NULL
+#define iter_file_splice_write NULL
+
+static inline void cdev_init(struct cdev *cdev, const struct file_operations *fops)
+{
+	memset(cdev, 0, sizeof(*cdev));
+	cdev->ops = fops;
+}
+
+static inline int cdev_add(struct cdev *cdev, dev_t dev, unsigned int count)
+{
+	(void)count;
+	cdev->dev = dev;
+	return 0;
+}
+
+static inline void cdev_del(struct cdev *cdev)
+{
+	(void)cdev;
+}
+
+static inline int alloc_chrdev_region(dev_t *dev, unsigned int baseminor, unsigned int count,
+		const char *name)
+{
+	(void)count;
+	(void)name;
+	*dev = MKDEV(240, baseminor);
+	return 0;
+}
+
+static inline void unregister_chrdev_region(dev_t dev, unsigned int count)
+{
+	(void)dev;
+	(void)count;
+}
+
+/* Device model and sysfs: attribute groups are kept so tests can call their show() */
+struct attribute {
+	const char *name;
+	unsigned short mode;
+};
+
+struct device;
+
+struct device_attribute {
+	struct attribute attr;
+	ssize_t (*show)(struct device *dev, struct device_attribute *attr, char *buf);
+};
+
+struct attribute_group {
+	struct attribute **attrs;
+};
+
+struct device {
+	void *driver_data;
+	const struct attribute_group **groups;
+};
+
+struct class {
+	const char *name;
+};
+
+#define DEVICE_ATTR_RO(_name) \
+	struct device_attribute dev_attr_##_name = { .attr = { #_name, 0444 }, .show = _name##_show }
+#define ATTRIBUTE_GROUPS(_name) \
+	static const struct attribute_group _name##_group = { .attrs = _name##_attrs }; \
+	static const struct attribute_group *_name##_groups[] = { &_name##_group, NULL }
+#define sysfs_emit(buf, ...) snprintf(buf, PAGE_SIZE, __VA_ARGS__)
+
+static inline void *dev_get_drvdata(const struct device *dev)
+{
+	return dev->driver_data;
+}
+
+static inline struct class *class_create(const char *name)
+{
+	struct class *cls = calloc(1, sizeof(*cls));
+	if (!cls) {
+		return ERR_PTR(-ENOMEM);
+	}
+	cls->name = name;
+	return cls;
+}
+
+static inline void class_destroy(struct class *cls)
+{
+	free(cls);
+}
+
+static inline struct device *device_create_with_groups(struct class *cls, struct device *parent,
+		dev_t devt, void *drvdata, const struct attribute_group **groups, const char *fmt, ...)
+{
+	struct device *dev = calloc(1, sizeof(*dev));
+	(void)cls;
+	(void)parent;
+	(void)devt;
+	(void)fmt;
+	if (!dev) {
+		return ERR_PTR(-ENOMEM);
+	}
+	dev->driver_data = drvdata;
+	dev->groups = groups;
+	return dev;
+}
+
+static inline void device_unregister(struct device *dev)
+{
+	free(dev);
+}
+
+/* debugfs: files are not created, the show functions only need to build */
+struct dentry;
+
+struct seq_file {
+	void *private;
+};
+
+struct kshim_show_fops {
+	int (*show)(struct seq_file *m, void *unused);
+};
+
+#define seq_printf(m, ...) ((void)(m), kshim_printk(__VA_ARGS__))
+#define DEFINE_SHOW_ATTRIBUTE(_name) \
+	static const struct kshim_show_fops _name##_fops = { .show = _name##_show }
+
+static inline struct dentry *debugfs_create_dir(const char *name, struct dentry *parent)
+{
+	(void)name;
+	(void)parent;
+	return NULL;
+}
+
+static inline struct dentry *debugfs_create_file(const char *name, unsigned short mode,
+		struct dentry *parent, void *data, const void *fops)
+{
+	(void)name;
+	(void)mode;
+	(void)parent;
+	(void)data;
+	(void)fops;
+	return NULL;
+}
+
+static inline void debugfs_remove_recursive(struct dentry *dentry)
+{
+	(void)dentry;
+}
+
+/* Tracepoints compile to empty functions */
+#define TP_PROTO(...) __VA_ARGS__
+#define TP_ARGS(...) __VA_ARGS__
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+	static inline void trace_##name(proto) \
+	{ \
+	}
+
+#endif /* AESD_CHAR_DRIVER_USERSPACE_KSHIM_H_ */
@@ -0,0 +1,639 @@
+/*
+ * File: aesd-channel.c
+ * Author: Suhas Reddy
+ * Brief: Sharded per-channel logs for aesdsocket. Each channel has its own lock,
+ *        readback cache and retention, so clients using different channels never
+ *        contend with each other. Channels are hashed onto shards and every shard
+ *        has a worker thread which commits packets queued by the client threads.
+ *        Client threads hand packets over through a lock-free MPSC queue, the
+ *        shard lock is only taken to wake an idle worker and to wait for the
+ *        commit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <syslog.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "aesd-channel.h"
+#include "aesd-mpsc.h"
+
+// Immutable, reference counted copy of a channel used to send readbacks
+// without holding the channel lock across the socket write
+struct aesd_channel_snapshot {
+    atomic_uint refs;
+    size_t size;
+    char data[];
+};
+
+// A committed packet. A single copy is shared by the channel ring and the
+// queue of every subscriber, each holding one reference.
+struct aesd_channel_msg {
+    atomic_uint refs;
+    unsigned long long seq;
+    size_t size;
+    char data[];
+};
+
+// A client following a channel. Its queue is protected by the channel lock.
+struct aesd_subscriber {
+    pthread_cond_t wake;   // signalled when a packet is queued or the subscriber is dropped
+    AESD_RING_MEMBERS_STATIC(struct aesd_channel_msg *, unsigned int, AESD_SUBSCRIBER_MAX_LAG_ENTRIES);
+    size_t bytes;
+    int sockfd;
+    atomic_bool dropped;   // set under the channel lock, also checked while sending without it
+    struct aesd_subscriber *next;
+};
+
+// How long a subscriber waits for its client to drain the socket before it
+// checks again whether it has been stopped or dropped
+#define AESD_SUBSCRIBER_POLL_MS 1000
+
+AESD_RING_DEFINE(channel_ring, struct aesd_channel, struct aesd_channel_msg *, size_t)
+AESD_RING_DEFINE_STATIC(subscriber_queue, struct aesd_subscriber, struct aesd_channel_msg *, unsigned int,
+        AESD_SUBSCRIBER_MAX_LAG_ENTRIES)
+
+// A packet queued by a client thread for the shard worker to commit
+struct aesd_channel_job {
+    struct aesd_channel *channel;
+    const char *data;
+    size_t size;
+    int status;
+    atomic_bool done;
+};
+
+struct aesd_channel_shard {
+    struct aesd_mpsc jobs; // queued by client threads, taken by the worker
+    pthread_mutex_t lock;  // protects channels and stop, serializes waking the worker
+    pthread_cond_t work;   // signalled when a job is queued while the worker is idle
+    pthread_cond_t done;   // broadcast when a batch of jobs has been committed
+    atomic_bool idle;      // set while the worker waits for work
+    struct aesd_channel *channels;
+    pthread_t worker;
+    bool running;
+    bool stop;
+};
+
+// Jobs a shard queue holds before client threads have to wait, and the most
+// the worker takes at once
+#define AESD_CHANNEL_JOB_QUEUE 256
+#define AESD_CHANNEL_JOB_BATCH 32
+
+static struct aesd_channel_shard shards[AESD_CHANNEL_MAX_SHARDS];
+static size_t nr_shards;
+// Channels created so far, bounded by AESD_CHANNEL_MAX
+static atomic_size_t nr_channels;
+
+// FNV-1a, used to spread channel names over the shards
+static size_t channel_hash(const char *name) {
+    size_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static struct aesd_channel_shard *channel_shard(const char *name) {
+    return &shards[channel_hash(name) % nr_shards];
+}
+
+static void snapshot_put(struct aesd_channel_snapshot *snap) {
+    if (snap && atomic_fetch_sub(&snap->refs, 1) == 1) {
+        free(snap);
+    }
+}
+
+static void msg_put(struct aesd_channel_msg *msg) {
+    if (atomic_fetch_sub(&msg->refs, 1) == 1) {
+        free(msg);
+    }
+}
+
+// Sends the whole buffer, retrying short writes. Returns 0 on success, -1 on failure
+static int send_all(int sockfd, const char *data, size_t size) {
+    size_t sent = 0;
+    while (sent < size) {
+        ssize_t rc = send(sockfd, data + sent, size - sent, MSG_NOSIGNAL);
+        if (rc == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        sent += rc;
+    }
+    return 0;
+}
+
+/**
+ * Sends the whole buffer to a subscriber's client, retrying short writes. Never blocks
+ * for longer than AESD_SUBSCRIBER_POLL_MS at a time, so a client that stopped reading
+ * cannot keep the subscriber from noticing @param stop or being dropped.
+ * @return 0 on success, -1 on failure
+ */
+static int subscriber_send(struct aesd_subscriber *sub, const char *data, size_t size, volatile bool *stop) {
+    size_t sent = 0;
+    while (sent < size) {
+        if (*stop || atomic_load_explicit(&sub->dropped, memory_order_relaxed)) {
+            return -1;
+        }
+        ssize_t rc = send(sub->sockfd, data + sent, size - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (rc == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pfd = { .fd = sub->sockfd, .events = POLLOUT };
+                if (poll(&pfd, 1, AESD_SUBSCRIBER_POLL_MS) == -1 && errno != EINTR) {
+                    return -1;
+                }
+                continue;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        sent += rc;
+    }
+    return 0;
+}
+
+// Releases everything queued for the subscriber and disconnects its client, which
+// also wakes the subscriber when it is blocked sending. Caller holds the channel lock
+static void subscriber_drop(struct aesd_subscriber *sub) {
+    struct aesd_channel_msg **queued;
+    while ((queued = subscriber_queue_pop(sub)) != NULL) {
+        msg_put(*queued);
+    }
+    sub->bytes = 0;
+    sub->dropped = true;
+    shutdown(sub->sockfd, SHUT_RDWR);
+    pthread_cond_signal(&sub->wake);
+}
+
+// Adds a reference to @param msg to the subscriber queue, caller holds the channel lock
+static void subscriber_push(struct aesd_subscriber *sub, struct aesd_channel_msg *msg) {
+    if (sub->dropped) {
+        return;
+    }
+    if (sub->full || sub->bytes + msg->size > AESD_SUBSCRIBER_MAX_LAG_BYTES) {
+        // Too far behind, release what it holds rather than growing without bound
+        subscriber_drop(sub);
+        return;
+    }
+    atomic_fetch_add(&msg->refs, 1);
+    *subscriber_queue_push(sub) = msg;
+    sub->bytes += msg->size;
+    pthread_cond_signal(&sub->wake);
+}
+
+// Drops the oldest packet of the channel, caller holds channel->lock
+static void channel_evict(struct aesd_channel *channel) {
+    struct aesd_channel_msg **slot = channel_ring_pop(channel);
+
+    channel->bytes -= (*slot)->size;
+    msg_put(*slot);
+    *slot = NULL;
+}
+
+// Stores a copy of the packet, applies retention and publishes the packet to
+// the subscribers. Caller holds channel->lock
+static int channel_commit(struct aesd_channel *channel, const char *data, size_t size) {
+    struct aesd_channel_msg *msg = malloc(sizeof(*msg) + size);
+    if (msg == NULL) {
+        return -ENOMEM;
+    }
+    atomic_init(&msg->refs, 1);
+    msg->seq = channel->next_seq++;
+    msg->size = size;
+    memcpy(msg->data, data, size);
+
+    if (channel->full) {
+        channel_evict(channel);
+    }
+    *channel_ring_push(channel) = msg;
+    channel->bytes += size;
+
+    // Never drop the packet just written, even when it alone exceeds the budget
+    while (channel->bytes > channel->retain_bytes && channel_ring_count(channel) > 1) {
+        channel_evict(channel);
+    }
+
+    for (struct aesd_subscriber *sub = channel->subscribers; sub != NULL; sub = sub->next) {
+        subscriber_push(sub, msg);
+    }
+
+    snapshot_put(channel->cache);
+    channel->cache = NULL;
+    return 0;
+}
+
+// Waits until jobs are queued or the shard is stopped. @return false once the worker should exit
+static bool shard_wait_work(struct aesd_channel_shard *shard) {
+    bool more;
+
+    pthread_mutex_lock(&shard->lock);
+    atomic_store_explicit(&shard->idle, true, memory_order_relaxed);
+    // Pairs with the fence in aesd_channel_append: either the producer sees idle
+    // set, or its job is visible to the check below
+    atomic_thread_fence(memory_order_seq_cst);
+    while (aesd_mpsc_empty(&shard->jobs) && !shard->stop) {
+        pthread_cond_wait(&shard->work, &shard->lock);
+    }
+    atomic_store_explicit(&shard->idle, false, memory_order_relaxed);
+    more = !aesd_mpsc_empty(&shard->jobs);
+    pthread_mutex_unlock(&shard->lock);
+    return more;
+}
+
+// Commits queued packets for all channels hashed onto this shard
+static void *shard_worker(void *arg) {
+    struct aesd_channel_shard *shard = arg;
+    struct aesd_channel_job *batch[AESD_CHANNEL_JOB_BATCH];
+
+    for (;;) {
+        size_t n = aesd_mpsc_dequeue_batch(&shard->jobs, (void **)batch, AESD_CHANNEL_JOB_BATCH);
+        if (n == 0) {
+            if (!shard_wait_work(shard)) {
+                break;
+            }
+            continue;
+        }
+
+        // Consecutive jobs for the same channel are committed under one lock hold
+        for (size_t i = 0; i < n; i++) {
+            struct aesd_channel *channel = batch[i]->channel;
+            if (i == 0 || batch[i - 1]->channel != channel) {
+                pthread_mutex_lock(&channel->lock);
+            }
+            batch[i]->status = channel_commit(channel, batch[i]->data, batch[i]->size);
+            if (i + 1 == n || batch[i + 1]->channel != channel) {
+                pthread_mutex_unlock(&channel->lock);
+            }
+        }
+
+        // A job lives on its client's stack, it must not be touched once done is set
+        pthread_mutex_lock(&shard->lock);
+        for (size_t i = 0; i < n; i++) {
+            atomic_store_explicit(&batch[i]->done, true, memory_order_release);
+        }
+        pthread_cond_broadcast(&shard->done);
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    return NULL;
+}
+
+// Starts one shard worker per online CPU, bounded by AESD_CHANNEL_MAX_SHARDS
+int aesd_channels_init(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    nr_shards = cpus < 1 ? 1 : (size_t)cpus;
+    if (nr_shards > AESD_CHANNEL_MAX_SHARDS) {
+        nr_shards = AESD_CHANNEL_MAX_SHARDS;
+    }
+
+    for (size_t i = 0; i < nr_shards; i++) {
+        struct aesd_channel_shard *shard = &shards[i];
+
+        if (aesd_mpsc_init(&shard->jobs, AESD_CHANNEL_JOB_QUEUE) != 0) {
+            syslog(LOG_ERR, "Channel shard %zu queue allocation error", i);
+            nr_shards = i;
+            aesd_channels_shutdown();
+            return -1;
+        }
+        pthread_mutex_init(&shard->lock, NULL);
+        pthread_cond_init(&shard->work, NULL);
+        pthread_cond_init(&shard->done, NULL);
+        atomic_init(&shard->idle, false);
+        shard->channels = NULL;
+        shard->stop = false;
+        if (pthread_create(&shard->worker, NULL, shard_worker, shard) != 0) {
+            syslog(LOG_ERR, "Channel shard %zu worker creation error", i);
+            nr_shards = i + 1;
+            aesd_channels_shutdown();
+            return -1;
+        }
+        shard->running = true;
+    }
+    return 0;
+}
+
+// Stops the shard workers once their queues are drained and frees every channel
+void aesd_channels_shutdown(void) {
+    for (size_t i = 0; i < nr_shards; i++) {
+        struct aesd_channel_shard *shard = &shards[i];
+
+        if (shard->running) {
+            pthread_mutex_lock(&shard->lock);
+            shard->stop = true;
+            pthread_cond_signal(&shard->work);
+            pthread_mutex_unlock(&shard->lock);
+            pthread_join(shard->worker, NULL);
+            shard->running = false;
+        }
+
+        struct aesd_channel *channel = shard->channels;
+        while (channel != NULL) {
+            struct aesd_channel *next = channel->next;
+            // Disconnecting the subscribers wakes them wherever they wait, they
+            // detach before the channel goes away
+            pthread_mutex_lock(&channel->lock);
+            for (struct aesd_subscriber *sub = channel->subscribers; sub != NULL; sub = sub->next) {
+                subscriber_drop(sub);
+            }
+            while (channel->subscribers != NULL) {
+                pthread_cond_wait(&channel->unsubscribed, &channel->lock);
+            }
+            pthread_mutex_unlock(&channel->lock);
+            while (channel_ring_count(channel) > 0) {
+                channel_evict(channel);
+            }
+            snapshot_put(channel->cache);
+            free(channel->slot);
+            pthread_cond_destroy(&channel->unsubscribed);
+            pthread_mutex_destroy(&channel->lock);
+            free(channel);
+            channel = next;
+        }
+        shard->channels = NULL;
+
+        pthread_cond_destroy(&shard->done);
+        pthread_cond_destroy(&shard->work);
+        pthread_mutex_destroy(&shard->lock);
+        aesd_mpsc_destroy(&shard->jobs);
+    }
+    nr_shards = 0;
+    atomic_store(&nr_channels, 0);
+}
+
+/**
+ * Checks whether @param packet starts with "AESDCHAN:<name>:".
+ * On success the channel name is copied to @param name (AESD_CHANNEL_NAME_MAX + 1 bytes)
+ * and @param payload_offs is set to the first byte after the prefix.
+ * Names are limited to [A-Za-z0-9_.-].
+ */
+bool aesd_channel_parse_prefix(const char *packet, size_t size, char *name, size_t *payload_offs) {
+    size_t prefix_len = strlen(AESD_CHANNEL_PREFIX);
+
+    if (size <= prefix_len || memcmp(packet, AESD_CHANNEL_PREFIX, prefix_len) != 0) {
+        return false;
+    }
+
+    size_t i;
+    for (i = 0; prefix_len + i < size && i <= AESD_CHANNEL_NAME_MAX; i++) {
+        char c = packet[prefix_len + i];
+        if (c == ':') {
+            break;
+        }
+        if (!(c == '_' || c == '-' || c == '.' ||
+              (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))) {
+            return false;
+        }
+        name[i] = c;
+    }
+    if (i == 0 || i > AESD_CHANNEL_NAME_MAX || prefix_len + i >= size) {
+        return false;
+    }
+    name[i] = '\0';
+    *payload_offs = prefix_len + i + 1;
+    return true;
+}
+
+// Looks up the channel called @param name, creating it on first use unless
+// AESD_CHANNEL_MAX channels already exist. Returns NULL on failure
+struct aesd_channel *aesd_channel_get(const char *name) {
+    struct aesd_channel_shard *shard = channel_shard(name);
+    struct aesd_channel *channel;
+
+    pthread_mutex_lock(&shard->lock);
+    for (channel = shard->channels; channel != NULL; channel = channel->next) {
+        if (strcmp(channel->name, name) == 0) {
+            pthread_mutex_unlock(&shard->lock);
+            return channel;
+        }
+    }
+
+    // Shards are locked independently, so a slot is claimed before the channel is created
+    if (atomic_fetch_add(&nr_channels, 1) >= AESD_CHANNEL_MAX) {
+        atomic_fetch_sub(&nr_channels, 1);
+        pthread_mutex_unlock(&shard->lock);
+        syslog(LOG_WARNING, "Rejecting channel %s, already %d channels", name, AESD_CHANNEL_MAX);
+        return NULL;
+    }
+
+    channel = calloc(1, sizeof(*channel));
+    if (channel != NULL) {
+        size_t slots = aesd_ring_roundup_pow_of_two(AESD_CHANNEL_RETAIN_ENTRIES);
+        struct aesd_channel_msg **entries = calloc(slots, sizeof(*entries));
+        if (entries == NULL) {
+            free(channel);
+            channel = NULL;
+        } else {
+            channel_ring_init(channel, entries, slots, AESD_CHANNEL_RETAIN_ENTRIES);
+            channel->retain_bytes = AESD_CHANNEL_RETAIN_BYTES;
+        }
+    }
+    if (channel == NULL) {
+        syslog(LOG_ERR, "Memory allocation error for channel %s", name);
+        atomic_fetch_sub(&nr_channels, 1);
+        pthread_mutex_unlock(&shard->lock);
+        return NULL;
+    }
+    snprintf(channel->name, sizeof(channel->name), "%s", name);
+    pthread_mutex_init(&channel->lock, NULL);
+    pthread_cond_init(&channel->unsubscribed, NULL);
+    channel->next = shard->channels;
+    shard->channels = channel;
+    pthread_mutex_unlock(&shard->lock);
+
+    syslog(LOG_USER, "Created channel %s", name);
+    return channel;
+}
+
+/**
+ * Hands the packet to the worker owning the channel's shard and waits until it
+ * has been committed, so a following readback always contains it.
+ * @return 0 on success or a negative errno value
+ */
+int aesd_channel_append(struct aesd_channel *channel, const char *data, size_t size) {
+    struct aesd_channel_shard *shard = channel_shard(channel->name);
+    struct aesd_channel_job job = {
+        .channel = channel,
+        .data = data,
+        .size = size,
+    };
+
+    atomic_init(&job.done, false);
+
+    // Lock-free handoff, only spins on a full queue while the worker catches up
+    while (aesd_mpsc_enqueue(&shard->jobs, &job) != 0) {
+        sched_yield();
+    }
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&shard->idle, memory_order_relaxed)) {
+        pthread_mutex_lock(&shard->lock);
+        pthread_cond_signal(&shard->work);
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    if (!atomic_load_explicit(&job.done, memory_order_acquire)) {
+        pthread_mutex_lock(&shard->lock);
+        while (!atomic_load_explicit(&job.done, memory_order_acquire)) {
+            pthread_cond_wait(&shard->done, &shard->lock);
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    return job.status;
+}
+
+// Returns a referenced snapshot of the channel, rebuilding the cache when stale
+static struct aesd_channel_snapshot *channel_snapshot(struct aesd_channel *channel) {
+    struct aesd_channel_snapshot *snap;
+
+    pthread_mutex_lock(&channel->lock);
+    snap = channel->cache;
+    if (snap == NULL) {
+        snap = malloc(sizeof(*snap) + channel->bytes);
+        if (snap != NULL) {
+            atomic_init(&snap->refs, 1);
+            snap->size = 0;
+            struct aesd_channel_msg **msg;
+            size_t i;
+            AESD_RING_FOREACH(channel_ring, msg, channel, i) {
+                memcpy(snap->data + snap->size, (*msg)->data, (*msg)->size);
+                snap->size += (*msg)->size;
+            }
+            channel->cache = snap;
+        }
+    }
+    if (snap != NULL) {
+        atomic_fetch_add(&snap->refs, 1);
+    }
+    pthread_mutex_unlock(&channel->lock);
+
+    return snap;
+}
+
+/**
+ * Sends the retained contents of @param channel to @param sockfd.
+ * @return 0 on success, -1 on failure
+ */
+int aesd_channel_send(struct aesd_channel *channel, int sockfd) {
+    struct aesd_channel_snapshot *snap = channel_snapshot(channel);
+    if (snap == NULL) {
+        syslog(LOG_ERR, "Memory allocation error for channel %s readback", channel->name);
+        return -1;
+    }
+
+    int rc = send_all(sockfd, snap->data, snap->size);
+    snapshot_put(snap);
+    return rc;
+}
+
+// Waits up to a second for the subscriber to have work, caller holds the channel lock
+static void subscriber_wait(struct aesd_channel *channel, struct aesd_subscriber *sub) {
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 1;
+    pthread_cond_timedwait(&sub->wake, &channel->lock, &deadline);
+}
+
+/**
+ * Keeps @param sockfd open and streams every packet committed to @param channel
+ * from now on. When @param from_seq is set, retained packets with a sequence
+ * number of at least @param start_seq are replayed first.
+ * Returns once the client disconnects, falls further behind than the lag policy
+ * allows or @param stop is set.
+ * @return 0 when stopped, -1 when the subscriber was dropped or the client went away
+ */
+int aesd_channel_subscribe(struct aesd_channel *channel, int sockfd, bool from_seq,
+        unsigned long long start_seq, volatile bool *stop) {
+    struct aesd_subscriber *sub = calloc(1, sizeof(*sub));
+    if (sub == NULL) {
+        syslog(LOG_ERR, "Memory allocation error for channel %s subscriber", channel->name);
+        return -1;
+    }
+    pthread_cond_init(&sub->wake, NULL);
+    subscriber_queue_init(sub, AESD_SUBSCRIBER_MAX_LAG_ENTRIES);
+    sub->sockfd = sockfd;
+    atomic_init(&sub->dropped, false);
+
+    pthread_mutex_lock(&channel->lock);
+    if (from_seq) {
+        struct aesd_channel_msg **msg;
+        size_t i;
+        AESD_RING_FOREACH(channel_ring, msg, channel, i) {
+            if ((*msg)->seq >= start_seq) {
+                subscriber_push(sub, *msg);
+            }
+        }
+    }
+    sub->next = channel->subscribers;
+    channel->subscribers = sub;
+
+    int rc = 0;
+    while (!*stop) {
+        if (sub->dropped) {
+            syslog(LOG_INFO, "Dropping lagging subscriber of channel %s", channel->name);
+            rc = -1;
+            break;
+        }
+        if (subscriber_queue_count(sub) == 0) {
+            subscriber_wait(channel, sub);
+            if (subscriber_queue_count(sub) == 0 && !sub->dropped) {
+                // Idle, make sure the client is still there
+                char c;
+                pthread_mutex_unlock(&channel->lock);
+                ssize_t peek = recv(sockfd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+                bool gone = peek == 0 || (peek == -1 && errno != EAGAIN && errno != EWOULDBLOCK);
+                pthread_mutex_lock(&channel->lock);
+                if (gone) {
+                    rc = -1;
+                    break;
+                }
+            }
+            continue;
+        }
+
+        struct aesd_channel_msg *msg = *subscriber_queue_pop(sub);
+        sub->bytes -= msg->size;
+        pthread_mutex_unlock(&channel->lock);
+
+        int send_rc = subscriber_send(sub, msg->data, msg->size, stop);
+        msg_put(msg);
+
+        pthread_mutex_lock(&channel->lock);
+        // Being stopped or dropped mid-send is handled at the top of the loop
+        if (send_rc != 0 && !*stop && !sub->dropped) {
+            rc = -1;
+            break;
+        }
+    }
+
+    struct aesd_subscriber **link = &channel->subscribers;
+    while (*link != sub) {
+        link = &(*link)->next;
+    }
+    *link = sub->next;
+    if (channel->subscribers == NULL) {
+        pthread_cond_broadcast(&channel->unsubscribed);
+    }
+    struct aesd_channel_msg **queued;
+    while ((queued = subscriber_queue_pop(sub)) != NULL) {
+        msg_put(*queued);
+    }
+    pthread_mutex_unlock(&channel->lock);
+
+    pthread_cond_destroy(&sub->wake);
+    free(sub);
+    return rc;
+}
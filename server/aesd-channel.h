@@ -0,0 +1,99 @@
+/*
+ * File: aesd-channel.h
+ * Author: Suhas Reddy
+ * Brief: Named, independently locked in-memory logs ("channels") for aesdsocket.
+ *        Channels are spread over a fixed set of shards, each owned by one worker
+ *        thread which commits packets into the channels hashed onto it.
+ *        Clients may also subscribe to a channel with
+ *          AESDSUBSCRIBE:<name>[,<start sequence>]\n
+ *        and are then streamed every packet committed to it.
+ */
+
+#ifndef AESD_CHANNEL_H
+#define AESD_CHANNEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "../aesd-char-driver/aesd-ring.h"
+
+// Packets starting with this prefix are routed to a named channel:
+//   AESDCHAN:<name>:<payload>\n
+#define AESD_CHANNEL_PREFIX "AESDCHAN:"
+#define AESD_CHANNEL_NAME_MAX 32
+
+// Default retention of a newly created channel, mirrors the aesdchar device
+#define AESD_CHANNEL_RETAIN_ENTRIES 10
+#define AESD_CHANNEL_RETAIN_BYTES (1024 * 1024)
+
+// Channels live until the server exits, so any client could otherwise make it hold
+// AESD_CHANNEL_RETAIN_BYTES for every new name it sends. Requests for new channels
+// beyond this many are rejected.
+#define AESD_CHANNEL_MAX 64
+
+// Upper bound on the number of shard worker threads
+#define AESD_CHANNEL_MAX_SHARDS 16
+
+// Lag policy: a subscriber with more than this many packets or bytes still
+// queued for it is dropped instead of holding on to the committed packets
+#define AESD_SUBSCRIBER_MAX_LAG_ENTRIES 256
+#define AESD_SUBSCRIBER_MAX_LAG_BYTES (4 * 1024 * 1024)
+
+struct aesd_channel_snapshot;
+struct aesd_channel_msg;
+struct aesd_subscriber;
+
+struct aesd_channel {
+    char name[AESD_CHANNEL_NAME_MAX + 1];
+    /**
+     * Protects every member below, only ever held for short in-memory updates
+     */
+    pthread_mutex_t lock;
+    /**
+     * Ring of the retained packets, oldest first, holding at most capacity of them.
+     * Packets are shared, reference counted buffers also queued to every subscriber.
+     */
+    AESD_RING_MEMBERS(struct aesd_channel_msg *, size_t);
+    /**
+     * Total bytes held in entries
+     */
+    size_t bytes;
+    /**
+     * Sequence number given to the next committed packet
+     */
+    unsigned long long next_seq;
+    /**
+     * Retention limit in bytes, the oldest packets are dropped once either it or the
+     * capacity of the ring is exceeded
+     */
+    size_t retain_bytes;
+    /**
+     * Contiguous copy of all retained packets used for readback, rebuilt lazily
+     * after the channel changes. NULL when stale.
+     */
+    struct aesd_channel_snapshot *cache;
+    /**
+     * Clients following the channel, see aesd_channel_subscribe()
+     */
+    struct aesd_subscriber *subscribers;
+    /**
+     * Broadcast when the last subscriber detaches
+     */
+    pthread_cond_t unsubscribed;
+    /**
+     * Next channel hashed onto the same shard
+     */
+    struct aesd_channel *next;
+};
+
+int aesd_channels_init(void);
+void aesd_channels_shutdown(void);
+
+bool aesd_channel_parse_prefix(const char *packet, size_t size, char *name, size_t *payload_offs);
+struct aesd_channel *aesd_channel_get(const char *name);
+int aesd_channel_append(struct aesd_channel *channel, const char *data, size_t size);
+int aesd_channel_send(struct aesd_channel *channel, int sockfd);
+int aesd_channel_subscribe(struct aesd_channel *channel, int sockfd, bool from_seq,
+        unsigned long long start_seq, volatile bool *stop);
+
+#endif /* AESD_CHANNEL_H */
@@ -0,0 +1,108 @@
+/*
+ * File: aesd-mpsc.c
+ * Author: Suhas Reddy
+ * Brief: Bounded lock-free multi-producer / single-consumer queue, see aesd-mpsc.h.
+ *        Follows the per-slot sequence scheme of D. Vyukov's bounded queue, with
+ *        the consumer side simplified for a single thread.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "aesd-mpsc.h"
+#include "../aesd-char-driver/aesd-ring.h"
+
+/**
+ * Initializes @param queue to hold at least @param capacity items, rounded up to a
+ * power of two so positions wrap with a mask.
+ * @return 0 on success, -EINVAL or -ENOMEM
+ */
+int aesd_mpsc_init(struct aesd_mpsc *queue, size_t capacity) {
+    size_t slots;
+
+    if (capacity == 0 || capacity > SIZE_MAX / 2 / sizeof(struct aesd_mpsc_slot)) {
+        return -EINVAL;
+    }
+    slots = aesd_ring_roundup_pow_of_two(capacity);
+    queue->slots = calloc(slots, sizeof(*queue->slots));
+    if (queue->slots == NULL) {
+        return -ENOMEM;
+    }
+    for (size_t i = 0; i < slots; i++) {
+        atomic_init(&queue->slots[i].seq, i);
+    }
+    queue->mask = slots - 1;
+    atomic_init(&queue->tail, 0);
+    queue->head = 0;
+    return 0;
+}
+
+// Releases the slots of @param queue, items still queued are the caller's
+void aesd_mpsc_destroy(struct aesd_mpsc *queue) {
+    free(queue->slots);
+    queue->slots = NULL;
+}
+
+/**
+ * Appends @param item, safe to call from any number of threads at once. Never blocks:
+ * producers only retry when another producer claimed the same position first.
+ * @return 0 on success or -EAGAIN when the queue is full
+ */
+int aesd_mpsc_enqueue(struct aesd_mpsc *queue, void *item) {
+    size_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    struct aesd_mpsc_slot *slot;
+
+    for (;;) {
+        slot = &queue->slots[pos & queue->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            // Free for this position, claim it unless another producer got there first
+            if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Still holds the item from one lap ago, the consumer is behind
+            return -EAGAIN;
+        } else {
+            pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        }
+    }
+
+    slot->item = item;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    return 0;
+}
+
+/**
+ * Takes up to @param max items, oldest first, into @param items. Only one thread may
+ * dequeue. Stops early at a position claimed by a producer that has not published
+ * its item yet, so per producer order is always kept.
+ * @return the number of items taken
+ */
+size_t aesd_mpsc_dequeue_batch(struct aesd_mpsc *queue, void **items, size_t max) {
+    size_t n;
+
+    for (n = 0; n < max; n++) {
+        struct aesd_mpsc_slot *slot = &queue->slots[queue->head & queue->mask];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != queue->head + 1) {
+            break;
+        }
+        items[n] = slot->item;
+        // Hand the slot to the producer of the next lap
+        atomic_store_explicit(&slot->seq, queue->head + queue->mask + 1, memory_order_release);
+        queue->head++;
+    }
+    return n;
+}
+
+/**
+ * @return true if the consumer would find nothing to dequeue right now. Only meaningful
+ * when called by the consumer.
+ */
+bool aesd_mpsc_empty(struct aesd_mpsc *queue) {
+    struct aesd_mpsc_slot *slot = &queue->slots[queue->head & queue->mask];
+    return atomic_load_explicit(&slot->seq, memory_order_acquire) != queue->head + 1;
+}
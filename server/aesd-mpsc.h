@@ -0,0 +1,56 @@
+/*
+ * File: aesd-mpsc.h
+ * Author: Suhas Reddy
+ * Brief: Bounded lock-free multi-producer / single-consumer queue of pointers, the
+ *        userspace counterpart of aesd_circular_buffer for handing work between
+ *        threads. Any number of threads may enqueue concurrently without a lock,
+ *        one thread dequeues, in batches. Items of each producer come out in the
+ *        order it enqueued them.
+ *
+ *        Every slot carries a sequence number telling producers and the consumer
+ *        whose turn it is, so no lock or per-item allocation is needed. Producer
+ *        and consumer positions live on separate cache lines.
+ */
+
+#ifndef AESD_MPSC_H
+#define AESD_MPSC_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define AESD_MPSC_CACHE_LINE 64
+
+struct aesd_mpsc_slot {
+    /**
+     * Equals the position of the slot while free for the producer enqueueing at that
+     * position, position + 1 once the item is published for the consumer
+     */
+    atomic_size_t seq;
+    void *item;
+};
+
+struct aesd_mpsc {
+    /**
+     * Read-mostly, shared by every thread
+     */
+    struct aesd_mpsc_slot *slots;
+    size_t mask;
+    /**
+     * Next position claimed by a producer
+     */
+    _Alignas(AESD_MPSC_CACHE_LINE) atomic_size_t tail;
+    /**
+     * Next position taken by the consumer, only ever touched by it
+     */
+    _Alignas(AESD_MPSC_CACHE_LINE) size_t head;
+    char pad[AESD_MPSC_CACHE_LINE - sizeof(size_t)];
+};
+
+int aesd_mpsc_init(struct aesd_mpsc *queue, size_t capacity);
+void aesd_mpsc_destroy(struct aesd_mpsc *queue);
+int aesd_mpsc_enqueue(struct aesd_mpsc *queue, void *item);
+size_t aesd_mpsc_dequeue_batch(struct aesd_mpsc *queue, void **items, size_t max);
+bool aesd_mpsc_empty(struct aesd_mpsc *queue);
+
+#endif /* AESD_MPSC_H */
@@ -13,6 +13,7 @@
 #include <unistd.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <ctype.h>
 #include <string.h>
 #include <fcntl.h>
 #include <syslog.h>
@@ -26,11 +27,15 @@
 #include <sys/queue.h>
 #include <time.h>
 #include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <errno.h>
 #include "../aesd-char-driver/aesd_ioctl.h"
+#include "aesd-channel.h"
 
 // Macros for 
 #define CUSTOM_PORT "9000"
 #define MAX_CUSTOM_BUFFER 1024
+#define SENDFILE_CHUNK (64 * 1024)
 #define USE_AESD_CHAR_DEVICE 1
 #ifdef USE_AESD_CHAR_DEVICE
 #define CUSTOM_LOG_FILE "/dev/aesdchar"
@@ -173,25 +178,68 @@ void *handle_client(void *arg) {
         }
     }
 
+    // Subscribers keep the connection open and are streamed every new packet of the channel
+    char channel_name[AESD_CHANNEL_NAME_MAX + 1];
+    unsigned long long start_seq;
+    int name_end = 0, seq_end = 0;
+    int subscribe_args = sscanf(packetBuffer, "AESDSUBSCRIBE:%32[A-Za-z0-9_.-]%n,%llu%n", channel_name, &name_end,
+            &start_seq, &seq_end);
+    // Like AESDCHAN: with a bad name, anything but "<name>\n" or "<name>,<digits>\n" is an
+    // ordinary packet. %llu alone would also take signs, spaces and trailing garbage.
+    bool subscribe = (subscribe_args == 1 && packetBuffer[name_end] == '\n') ||
+            (subscribe_args == 2 && isdigit((unsigned char)packetBuffer[name_end + 1]) &&
+             packetBuffer[seq_end] == '\n');
+    if (subscribe) {
+        struct aesd_channel *channel = aesd_channel_get(channel_name);
+        if (channel != NULL) {
+            aesd_channel_subscribe(channel, client_fd, subscribe_args == 2, start_seq, &sig_exit);
+        }
+        close(fd);
+        close(client_fd);
+        remove_thread(pthread_self());
+        pthread_exit(NULL);
+    }
+
+    // Packets carrying a channel prefix go to their own log and only read that log back
+    size_t payload_offs;
+    if (aesd_channel_parse_prefix(packetBuffer, packetSize, channel_name, &payload_offs)) {
+        struct aesd_channel *channel = aesd_channel_get(channel_name);
+        if (channel == NULL ||
+            aesd_channel_append(channel, packetBuffer + payload_offs, packetSize - payload_offs) != 0 ||
+            aesd_channel_send(channel, client_fd) != 0) {
+            syslog(LOG_INFO, "Couldn't complete request on channel %s", channel_name);
+        }
+        close(fd);
+        close(client_fd);
+        remove_thread(pthread_self());
+        pthread_exit(NULL);
+    }
+
     if(sscanf(packetBuffer, "AESDCHAR_IOCSEEKTO:%u,%u", &seekto.write_cmd, &seekto.write_cmd_offset) == 2) {
         ioctl(fd, AESDCHAR_IOCSEEKTO, &seekto);
     } else {
-        pthread_mutex_lock(&list_mutex);
+        pthread_mutex_lock(&file_mutex);
         if (write(fd, packetBuffer, packetSize) != packetSize) {
             syslog(LOG_INFO, "Couldn't write to file");
             close(fd);
-            pthread_mutex_unlock(&list_mutex);
+            pthread_mutex_unlock(&file_mutex);
             pthread_exit(NULL);
         }
-        pthread_mutex_unlock(&list_mutex);
+        pthread_mutex_unlock(&file_mutex);
     }
 
-    // Read from file and send back over socket
+    // Let the kernel move the file content straight to the socket
     ssize_t bytes_read;
-    while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0) {
-        if (send(client_fd, buffer, bytes_read, 0) == -1) {
-            syslog(LOG_INFO, "Error sending file content back to client");
-            break;
+    while ((bytes_read = sendfile(client_fd, fd, NULL, SENDFILE_CHUNK)) > 0) {
+    }
+
+    if (bytes_read == -1 && (errno == EINVAL || errno == ENOSYS)) {
+        // The file can't be spliced, read from file and send back over socket
+        while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0) {
+            if (send(client_fd, buffer, bytes_read, 0) == -1) {
+                syslog(LOG_INFO, "Error sending file content back to client");
+                break;
+            }
         }
     }
 
@@ -409,6 +457,11 @@ int main(int argc, char *argv[]) {
         daemonize();
     }
     
+    if (aesd_channels_init() != 0) {
+        cleanup_resources();
+        exit(EXIT_FAILURE);
+    }
+
     pthread_t timestamp_thread;
     if (pthread_create(&timestamp_thread, NULL, append_timestamp, NULL) != 0) {
         syslog(LOG_ERR, "Timestamp thread creation error");
@@ -426,6 +479,7 @@ int main(int argc, char *argv[]) {
 
     // Join completed threads after the main loop
     join_completed_threads();
+    aesd_channels_shutdown();
 
     // Cleanup resources
     cleanup_resources();
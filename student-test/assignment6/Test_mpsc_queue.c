@@ -0,0 +1,120 @@
+#include "unity.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "../../server/aesd-mpsc.h"
+
+#define MPSC_PRODUCERS 8
+#define MPSC_ITEMS_PER_PRODUCER 100000
+
+// Each item encodes its producer in the high bits and its per producer sequence number,
+// starting at 1 so no item is a NULL pointer
+#define MPSC_ITEM(producer, seq) ((void *)(((uintptr_t)(producer) << 24) | (uintptr_t)(seq)))
+#define MPSC_ITEM_PRODUCER(item) ((unsigned int)((uintptr_t)(item) >> 24))
+#define MPSC_ITEM_SEQ(item) ((unsigned int)((uintptr_t)(item) & 0xffffff))
+
+struct mpsc_producer {
+    struct aesd_mpsc *queue;
+    unsigned int id;
+};
+
+static void *mpsc_produce(void *arg)
+{
+    struct mpsc_producer *producer = arg;
+
+    for (unsigned int seq = 1; seq <= MPSC_ITEMS_PER_PRODUCER; seq++) {
+        while (aesd_mpsc_enqueue(producer->queue, MPSC_ITEM(producer->id, seq)) != 0) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+void test_mpsc_fifo_single_thread()
+{
+    struct aesd_mpsc queue;
+    void *items[8];
+    uintptr_t i;
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, aesd_mpsc_init(&queue, 3), "Init should round up to 4 slots");
+    TEST_ASSERT_TRUE_MESSAGE(aesd_mpsc_empty(&queue), "A new queue should be empty");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, aesd_mpsc_dequeue_batch(&queue, items, 8),
+            "Dequeue from an empty queue should return nothing");
+    // Several laps over the slots
+    for (uintptr_t base = 1; base < 40; base += 4) {
+        for (i = 0; i < 4; i++) {
+            TEST_ASSERT_EQUAL_INT_MESSAGE(0, aesd_mpsc_enqueue(&queue, (void *)(base + i)),
+                    "Enqueue into a queue with room should succeed");
+        }
+        TEST_ASSERT_EQUAL_INT_MESSAGE(-EAGAIN, aesd_mpsc_enqueue(&queue, (void *)base),
+                "Enqueue into a full queue should fail");
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(3, aesd_mpsc_dequeue_batch(&queue, items, 3),
+                "Batch dequeue should stop at its limit");
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, aesd_mpsc_dequeue_batch(&queue, items + 3, 8),
+                "Batch dequeue should stop when the queue is empty");
+        for (i = 0; i < 4; i++) {
+            TEST_ASSERT_EQUAL_PTR_MESSAGE((void *)(base + i), items[i], "Items out of order");
+        }
+    }
+    TEST_ASSERT_TRUE_MESSAGE(aesd_mpsc_empty(&queue), "Queue should be empty after draining");
+    aesd_mpsc_destroy(&queue);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-EINVAL, aesd_mpsc_init(&queue, 0), "A queue without slots is invalid");
+}
+
+/**
+ * Many producers racing on a small queue, so it is full most of the time and wraps
+ * thousands of times. The consumer checks that every item arrives exactly once and
+ * that each producer's items arrive in the order they were enqueued.
+ */
+void test_mpsc_stress_no_loss_no_reorder()
+{
+    struct aesd_mpsc queue;
+    struct mpsc_producer producers[MPSC_PRODUCERS];
+    pthread_t threads[MPSC_PRODUCERS];
+    unsigned int last_seq[MPSC_PRODUCERS] = {0};
+    unsigned long total = 0;
+    void *items[16];
+    bool in_order = true, known_producer = true;
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, aesd_mpsc_init(&queue, 64), "Init should succeed");
+    for (unsigned int p = 0; p < MPSC_PRODUCERS; p++) {
+        producers[p] = (struct mpsc_producer){ .queue = &queue, .id = p };
+        TEST_ASSERT_EQUAL_INT_MESSAGE(0, pthread_create(&threads[p], NULL, mpsc_produce, &producers[p]),
+                "Producer creation should succeed");
+    }
+
+    // Assertions are only made from this thread
+    while (total < (unsigned long)MPSC_PRODUCERS * MPSC_ITEMS_PER_PRODUCER) {
+        size_t n = aesd_mpsc_dequeue_batch(&queue, items, 16);
+        if (n == 0) {
+            sched_yield();
+            continue;
+        }
+        for (size_t i = 0; i < n; i++) {
+            unsigned int p = MPSC_ITEM_PRODUCER(items[i]);
+            if (p >= MPSC_PRODUCERS) {
+                known_producer = false;
+                continue;
+            }
+            if (MPSC_ITEM_SEQ(items[i]) != last_seq[p] + 1) {
+                in_order = false;
+            }
+            last_seq[p] = MPSC_ITEM_SEQ(items[i]);
+        }
+        total += n;
+    }
+
+    for (unsigned int p = 0; p < MPSC_PRODUCERS; p++) {
+        pthread_join(threads[p], NULL);
+    }
+    TEST_ASSERT_TRUE_MESSAGE(known_producer, "Dequeued an item no producer enqueued");
+    TEST_ASSERT_TRUE_MESSAGE(in_order, "Items of a producer were lost, duplicated or reordered");
+    for (unsigned int p = 0; p < MPSC_PRODUCERS; p++) {
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(MPSC_ITEMS_PER_PRODUCER, last_seq[p],
+                "Every item of each producer should be dequeued");
+    }
+    TEST_ASSERT_TRUE_MESSAGE(aesd_mpsc_empty(&queue), "Nothing should be left after all items arrived");
+    aesd_mpsc_destroy(&queue);
+}
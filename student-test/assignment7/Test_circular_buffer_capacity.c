@@ -0,0 +1,169 @@
+#include "unity.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+/**
+* Fills a buffer of @param capacity entries with @param writes numbered entries and checks that
+* exactly the newest min(writes, capacity) entries are found, in order, at the expected offsets.
+*/
+static void verify_capacity(unsigned int capacity, unsigned int writes)
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry entry;
+    char *strings = malloc(writes * 24);
+    size_t offset = 0;
+    size_t entry_offset;
+    unsigned int first = writes > capacity ? writes - capacity : 0;
+    unsigned int i;
+
+    TEST_ASSERT_NOT_NULL(strings);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, aesd_circular_buffer_init_capacity(&buffer, capacity),
+            "Buffer initialization failed");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, (buffer.mask + 1) & buffer.mask,
+            "Slot count must be a power of two");
+    TEST_ASSERT_TRUE_MESSAGE(buffer.mask + 1 >= capacity, "Not enough slots for the capacity");
+
+    for (i = 0; i < writes; i++) {
+        snprintf(&strings[i * 24], 24, "write%u\n", i);
+        entry.buffptr = &strings[i * 24];
+        entry.size = strlen(entry.buffptr);
+        aesd_circular_buffer_add_entry(&buffer, &entry);
+    }
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(writes - first, aesd_circular_buffer_count(&buffer),
+            "Unexpected number of retained entries");
+
+    for (i = first; i < writes; i++) {
+        const struct aesd_buffer_entry *found =
+            aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, offset, &entry_offset);
+        TEST_ASSERT_NOT_NULL_MESSAGE(found, "Retained entry not found");
+        TEST_ASSERT_EQUAL_PTR_MESSAGE(&strings[i * 24], found->buffptr, "Entries out of order");
+        TEST_ASSERT_EQUAL_INT_MESSAGE(0, entry_offset, "Entry does not start at expected offset");
+        offset += found->size;
+    }
+    TEST_ASSERT_NULL_MESSAGE(aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, offset, &entry_offset),
+            "Found an entry past the end of the buffer");
+
+    aesd_circular_buffer_free(&buffer);
+    free(strings);
+}
+
+void test_circular_buffer_capacities()
+{
+    unsigned int capacities[] = { 1, 2, 3, 10, 16, 17, 100, 1024 };
+    unsigned int i;
+
+    for (i = 0; i < sizeof(capacities) / sizeof(capacities[0]); i++) {
+        verify_capacity(capacities[i], capacities[i] / 2);
+        verify_capacity(capacities[i], capacities[i]);
+        verify_capacity(capacities[i], capacities[i] * 3 + 1);
+    }
+}
+
+void test_circular_buffer_default_capacity()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry entry;
+
+    aesd_circular_buffer_init(&buffer);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, buffer.capacity,
+            "aesd_circular_buffer_init() should use the compile time default capacity");
+    aesd_circular_buffer_free(&buffer);
+
+    // The default capacity is stored in the buffer itself, callers which never free it don't leak
+    aesd_circular_buffer_init(&buffer);
+    TEST_ASSERT_TRUE_MESSAGE(buffer.slot == buffer.default_slot,
+            "aesd_circular_buffer_init() should not allocate entry storage");
+    for (unsigned int i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * 2; i++) {
+        entry.buffptr = "entry\n";
+        entry.size = 6;
+        aesd_circular_buffer_add_entry(&buffer, &entry);
+    }
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, aesd_circular_buffer_count(&buffer),
+            "A default buffer should retain AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries");
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-EINVAL, aesd_circular_buffer_init_capacity(&buffer, 0),
+            "A zero capacity should be rejected");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-EINVAL, aesd_circular_buffer_init_capacity(&buffer, AESDCHAR_MAX_CAPACITY + 1),
+            "Capacities above AESDCHAR_MAX_CAPACITY should be rejected");
+}
+
+void test_circular_buffer_resize()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry entry;
+    const char *writes[] = { "a\n", "bb\n", "ccc\n", "dddd\n", "eeeee\n" };
+    size_t entry_offset;
+    unsigned int i;
+
+    aesd_circular_buffer_init_capacity(&buffer, 4);
+    for (i = 0; i < 5; i++) {
+        entry.buffptr = writes[i];
+        entry.size = strlen(writes[i]);
+        aesd_circular_buffer_add_entry(&buffer, &entry);
+    }
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-EINVAL, aesd_circular_buffer_resize(&buffer, 2),
+            "Resizing below the number of stored entries should fail");
+    TEST_ASSERT_EQUAL_PTR_MESSAGE(writes[1], aesd_circular_buffer_remove_entry(&buffer),
+            "remove_entry should return the oldest entry");
+    TEST_ASSERT_EQUAL_PTR_MESSAGE(writes[2], aesd_circular_buffer_remove_entry(&buffer),
+            "remove_entry should return the oldest entry");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, aesd_circular_buffer_resize(&buffer, 2), "Resize failed");
+    TEST_ASSERT_TRUE_MESSAGE(buffer.full, "Buffer holding capacity entries should be full");
+    TEST_ASSERT_EQUAL_PTR_MESSAGE(writes[3],
+            aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, 0, &entry_offset)->buffptr,
+            "Oldest entry not kept across resize");
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, aesd_circular_buffer_resize(&buffer, 33), "Resize failed");
+    for (i = 0; i < 33; i++) {
+        entry.buffptr = writes[i % 5];
+        entry.size = strlen(writes[i % 5]);
+        aesd_circular_buffer_add_entry(&buffer, &entry);
+    }
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(33, aesd_circular_buffer_count(&buffer), "Grown buffer not filled");
+    aesd_circular_buffer_free(&buffer);
+}
+
+void test_circular_buffer_offsets()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry entry;
+    const char *writes[] = { "a\n", "bb\n", "ccc\n", "dddd\n", "eeeee\n" };
+    size_t fpos;
+    size_t entry_offset;
+    unsigned int i;
+
+    aesd_circular_buffer_init_capacity(&buffer, 3);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-1, aesd_circular_buffer_find_index_for_fpos(&buffer, 0, &entry_offset),
+            "Nothing should be found in an empty buffer");
+    for (i = 0; i < 5; i++) {
+        entry.buffptr = writes[i];
+        entry.size = strlen(writes[i]);
+        aesd_circular_buffer_add_entry(&buffer, &entry);
+    }
+
+    // "ccc\ndddd\neeeee\n" remains after evicting the first two writes
+    TEST_ASSERT_EQUAL_INT_MESSAGE(15, aesd_circular_buffer_size(&buffer), "Total size not updated on eviction");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(1, aesd_circular_buffer_find_index_for_fpos(&buffer, 6, &entry_offset),
+            "Wrong entry index for fpos");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(2, entry_offset, "Wrong entry offset for fpos");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(2, aesd_circular_buffer_find_index_for_fpos(&buffer, 14, &entry_offset),
+            "Wrong entry index for the last byte");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-1, aesd_circular_buffer_find_index_for_fpos(&buffer, 15, &entry_offset),
+            "Found an entry past the end of the buffer");
+
+    TEST_ASSERT_EQUAL_PTR_MESSAGE(writes[4], aesd_circular_buffer_get_entry(&buffer, 2, &fpos)->buffptr,
+            "Wrong entry for index");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(9, fpos, "Wrong fpos for index");
+    TEST_ASSERT_NULL_MESSAGE(aesd_circular_buffer_get_entry(&buffer, 3, &fpos), "Index past the last entry");
+
+    aesd_circular_buffer_remove_entry(&buffer);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(11, aesd_circular_buffer_size(&buffer), "Total size not updated on removal");
+    aesd_circular_buffer_get_entry(&buffer, 0, &fpos);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, fpos, "Oldest entry should start at fpos 0");
+    aesd_circular_buffer_free(&buffer);
+}
@@ -0,0 +1,123 @@
+#include "unity.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+/**
+* Reads @param size bytes at running offset @param offs out of the ring of @param buffer
+*/
+static void read_ring(struct aesd_circular_buffer *buffer, size_t offs, char *dst, size_t size)
+{
+    size_t i;
+    for (i = 0; i < size; i++) {
+        dst[i] = *aesd_circular_buffer_ring_ptr(buffer, offs + i);
+    }
+    dst[size] = '\0';
+}
+
+static void add_string(struct aesd_circular_buffer *buffer, const char *str)
+{
+    struct aesd_buffer_entry entry;
+    entry.buffptr = str;
+    entry.size = strlen(str);
+    TEST_ASSERT_NULL_MESSAGE(aesd_circular_buffer_add_entry(buffer, &entry),
+            "Ring entries should never hand back memory to free");
+}
+
+void test_circular_buffer_ring_attach()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry entry = { .buffptr = "x\n", .size = 2 };
+    char ring[16];
+
+    aesd_circular_buffer_init_capacity(&buffer, 4);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-EINVAL, aesd_circular_buffer_attach_ring(&buffer, ring, 12),
+            "Ring sizes must be a power of two");
+    aesd_circular_buffer_add_entry(&buffer, &entry);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-EINVAL, aesd_circular_buffer_attach_ring(&buffer, ring, sizeof(ring)),
+            "A ring can only be attached to an empty buffer");
+    aesd_circular_buffer_free(&buffer);
+
+    aesd_circular_buffer_init_capacity(&buffer, 4);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, aesd_circular_buffer_attach_ring(&buffer, ring, sizeof(ring)),
+            "Attaching a ring failed");
+    entry.buffptr = "this is longer than the ring\n";
+    entry.size = strlen(entry.buffptr);
+    aesd_circular_buffer_add_entry(&buffer, &entry);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, aesd_circular_buffer_count(&buffer),
+            "Entries larger than the ring should be rejected");
+    aesd_circular_buffer_free(&buffer);
+}
+
+void test_circular_buffer_ring_eviction()
+{
+    struct aesd_circular_buffer buffer;
+    const char *writes[] = { "aaaa\n", "bbb\n", "cc\n", "ddddddd\n", "e\n" };
+    struct aesd_buffer_entry *entry;
+    char ring[16];
+    char data[17];
+    size_t fpos;
+    unsigned int i;
+
+    aesd_circular_buffer_init_capacity(&buffer, 4);
+    aesd_circular_buffer_attach_ring(&buffer, ring, sizeof(ring));
+    for (i = 0; i < 3; i++) {
+        add_string(&buffer, writes[i]);
+    }
+    TEST_ASSERT_EQUAL_INT_MESSAGE(12, aesd_circular_buffer_size(&buffer), "Unexpected ring contents");
+
+    // "ddddddd\n" needs 8 bytes, so "aaaa\n" is evicted and the copy wraps
+    add_string(&buffer, writes[3]);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(3, aesd_circular_buffer_count(&buffer),
+            "Oldest entries should be evicted by bytes");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(buffer.end_offs, buffer.write_offs, "write_offs not advanced");
+    entry = aesd_circular_buffer_get_entry(&buffer, 2, &fpos);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(7, fpos, "Wrong fpos of wrapped entry");
+    read_ring(&buffer, entry->offs, data, entry->size);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(writes[3], data, "Wrapped entry corrupted");
+
+    // Count based eviction still applies
+    add_string(&buffer, writes[4]);
+    add_string(&buffer, writes[4]);
+    add_string(&buffer, writes[4]);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(4, aesd_circular_buffer_count(&buffer), "Capacity not enforced");
+    read_ring(&buffer, buffer.end_offs - aesd_circular_buffer_size(&buffer), data,
+            aesd_circular_buffer_size(&buffer));
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("ddddddd\ne\ne\ne\n", data, "Ring contents out of order");
+    aesd_circular_buffer_free(&buffer);
+}
+
+void test_circular_buffer_ring_copy()
+{
+    struct aesd_circular_buffer buffer, copy;
+    char ring[32];
+    char data[33];
+
+    aesd_circular_buffer_init_capacity(&buffer, 8);
+    aesd_circular_buffer_attach_ring(&buffer, ring, sizeof(ring));
+    add_string(&buffer, "one\n");
+    add_string(&buffer, "two\n");
+    add_string(&buffer, "three\n");
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-EINVAL, aesd_circular_buffer_init_copy(&copy, &buffer, 2),
+            "Copies must have room for every entry");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, aesd_circular_buffer_init_copy_newest(&copy, &buffer, 2),
+            "Copy of the newest entries failed");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(2, aesd_circular_buffer_count(&copy), "Copy should keep the newest entries");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(10, aesd_circular_buffer_size(&copy), "Copy should only count the newest entries");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(3, aesd_circular_buffer_count(&buffer), "The source must be left untouched");
+    read_ring(&copy, copy.end_offs - aesd_circular_buffer_size(&copy), data, aesd_circular_buffer_size(&copy));
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("two\nthree\n", data, "Copy should hold the newest entries");
+    aesd_circular_buffer_free(&copy);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, aesd_circular_buffer_init_copy(&copy, &buffer, 3), "Copy failed");
+    TEST_ASSERT_TRUE_MESSAGE(copy.full, "Copy holding capacity entries should be full");
+    TEST_ASSERT_EQUAL_PTR_MESSAGE(ring, copy.ring, "Copies share the ring");
+    TEST_ASSERT_TRUE_MESSAGE(copy.generation != buffer.generation, "Copies get a new generation");
+    aesd_circular_buffer_free(&buffer);
+
+    add_string(&copy, "four\n");
+    read_ring(&copy, copy.end_offs - aesd_circular_buffer_size(&copy), data, aesd_circular_buffer_size(&copy));
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("two\nthree\nfour\n", data, "Copy lost ring contents");
+    aesd_circular_buffer_free(&copy);
+}
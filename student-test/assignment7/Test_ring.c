@@ -0,0 +1,81 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-ring.h"
+
+// Index type narrower than int, so wrapping of in_offs/out_offs is exercised quickly
+struct byte_ring {
+    AESD_RING_MEMBERS_STATIC(int, uint8_t, 8);
+};
+AESD_RING_DEFINE_STATIC(byte_ring, struct byte_ring, int, uint8_t, 8)
+
+struct ptr_ring {
+    AESD_RING_MEMBERS(const char *, unsigned short);
+};
+AESD_RING_DEFINE(ptr_ring, struct ptr_ring, const char *, unsigned short)
+
+void test_ring_static_wraps()
+{
+    struct byte_ring ring;
+    int *elem;
+    uint8_t i;
+    int next = 0, expect = 0;
+    unsigned int round;
+
+    byte_ring_init(&ring, 8);
+    TEST_ASSERT_NULL_MESSAGE(byte_ring_pop(&ring), "Pop of an empty ring should fail");
+    // Many more pushes than slots, always keeping the ring between 1 and 8 elements
+    for (round = 0; round < 100; round++) {
+        while (!ring.full) {
+            *byte_ring_push(&ring) = next++;
+        }
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(8, byte_ring_count(&ring), "A full ring holds capacity elements");
+        while (byte_ring_count(&ring) > 1) {
+            TEST_ASSERT_EQUAL_INT_MESSAGE(expect++, *byte_ring_pop(&ring), "Elements out of order");
+        }
+    }
+    AESD_RING_FOREACH(byte_ring, elem, &ring, i) {
+        TEST_ASSERT_EQUAL_INT_MESSAGE(expect, *elem, "Foreach should start at the oldest element");
+    }
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, i, "Foreach should only visit stored elements");
+}
+
+void test_ring_capacity_below_slots()
+{
+    const char *strings[] = { "a", "b", "c", "d", "e", "f", "g" };
+    const char *slots[8];
+    struct ptr_ring ring;
+    const char **elem;
+    unsigned short i;
+    unsigned int n;
+
+    memset(slots, 0, sizeof(slots));
+    ptr_ring_init(&ring, slots, 8, 5);
+    for (n = 0; n < 7; n++) {
+        if (ring.full) {
+            ptr_ring_pop(&ring);
+        }
+        *ptr_ring_push(&ring) = strings[n];
+    }
+    TEST_ASSERT_TRUE_MESSAGE(ring.full, "Ring holding capacity elements should be full");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(5, ptr_ring_count(&ring), "Capacity not enforced");
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("c", *ptr_ring_at(&ring, 0), "Oldest elements not dropped first");
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("g", *ptr_ring_peek(&ring, 4), "Newest element not last");
+
+    n = 2;
+    AESD_RING_FOREACH(ptr_ring, elem, &ring, i) {
+        TEST_ASSERT_EQUAL_PTR_MESSAGE(strings[n++], *elem, "Foreach out of order");
+    }
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(7, n, "Foreach should visit every stored element");
+
+    while (ptr_ring_pop(&ring)) {
+    }
+    TEST_ASSERT_FALSE_MESSAGE(ring.full, "Emptied ring should not be full");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, ptr_ring_count(&ring), "Emptied ring should be empty");
+    AESD_RING_FOREACH(ptr_ring, elem, &ring, i) {
+        TEST_ASSERT_TRUE_MESSAGE(false, "Foreach should skip every slot of an empty ring");
+    }
+    TEST_ASSERT_EQUAL_INT_MESSAGE(8, aesd_ring_roundup_pow_of_two(5), "Slots for 5 elements");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(8, aesd_ring_roundup_pow_of_two(8), "Slots for 8 elements");
+}